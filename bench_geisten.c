@@ -0,0 +1,621 @@
+//
+// Micro benchmarks of the geisten kernels. Type 'make bench' to run them.
+//
+#include <stdio.h>
+#include <time.h>
+
+#include "geisten.h"
+
+#define ARRAY_LENGTH(_arr) (sizeof((_arr)) / sizeof(((_arr)[0])))
+#define BENCH_WORDS 4096
+#define BENCH_ROUNDS 2000
+
+/* Prevents the compiler from removing the benchmarked computation */
+static volatile long long bench_sink;
+
+#ifdef GEISTEN_X86_64
+#include <x86intrin.h>
+#define cycles() ((double)__rdtsc())
+#define CYCLES_UNIT "bits/cycle"
+#else
+#define cycles() now_ns()
+#define CYCLES_UNIT "bits/ns"
+#endif
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned long long random_word() {
+    return ((unsigned long long)random() << 62) ^
+           ((unsigned long long)random() << 31) ^ (unsigned long long)random();
+}
+
+/* The data dependent loop used by all popcount calls before the dispatch */
+#define linear_soft(_w, _x) \
+    ((int)NBITS((_x)) - 2 * popcountll_kernighan((_x) ^ (_w)))
+
+#define BENCH_LINEAR(_name, _linear, _w, _x)                                 \
+    do {                                                                     \
+        double start = now_ns();                                             \
+        long long sum = 0;                                                   \
+        foreach_to(r, BENCH_ROUNDS) {                                        \
+            foreach_to(i, BENCH_WORDS) { sum += _linear((_w)[i], (_x)[i]); } \
+        }                                                                    \
+        double ns = now_ns() - start;                                        \
+        bench_sink = sum;                                                    \
+        printf("  %-24s %8.1f Mwords/s\n", (_name),                          \
+               1e3 * BENCH_WORDS * BENCH_ROUNDS / ns);                       \
+    } while (0)
+
+static void bench_linear() {
+    static unsigned long long w[BENCH_WORDS], random_x[BENCH_WORDS],
+        dense_x[BENCH_WORDS];
+    foreach (i, w) {
+        w[i]        = random_word();
+        random_x[i] = random_word();
+        /* about 60 of 64 bits differ: worst case for the soft loop */
+        dense_x[i] = ~w[i] ^ (random_word() & 0x0101010101010101ULL);
+    }
+    printf("linear() - popcnt %s\n",
+           geisten_cpu_has(GEISTEN_CPU_POPCNT) ? "available" : "missing");
+    BENCH_LINEAR("soft, random words", linear_soft, w, random_x);
+    BENCH_LINEAR("native, random words", linear, w, random_x);
+    BENCH_LINEAR("soft, dense words", linear_soft, w, dense_x);
+    BENCH_LINEAR("native, dense words", linear, w, dense_x);
+}
+
+/* The word-by-word popcount macro used before popcount_xor() */
+static size_t popcount_xor_words(size_t words, const unsigned long long a[],
+                                 const unsigned long long b[]) {
+    size_t count = 0;
+    foreach_to(i, words) { count += popcount(a[i] ^ b[i]); }
+    return count;
+}
+
+static __attribute__((noinline)) double bench_row(popcount_xor_fn kernel,
+                                                  size_t words,
+                                                  const unsigned long long a[],
+                                                  const unsigned long long b[]) {
+    size_t rounds = (1 << 24) / words, sum = 0;
+    double start  = cycles();
+    foreach_to(r, rounds) {
+        sum += kernel(words, a, b);
+        __asm__ volatile("" : "+r"(kernel) : : "memory");
+    }
+    double elapsed = cycles() - start;
+    bench_sink     = sum;
+    return NBITS(a[0]) * words * rounds / elapsed;
+}
+
+static void bench_popcount_xor() {
+    enum { MAX_WORDS = 1024 };
+    static unsigned long long a[MAX_WORDS], b[MAX_WORDS];
+    foreach (i, a) {
+        a[i] = random_word();
+        b[i] = random_word();
+    }
+    printf("popcount_xor() - avx2 %s, " CYCLES_UNIT "\n",
+           geisten_cpu_has(GEISTEN_CPU_AVX2) ? "available" : "missing");
+    printf("  %8s %10s %10s %10s\n", "bits", "popcount", "dispatch", "avx2");
+    for (size_t words = 1; words <= MAX_WORDS; words *= 4) {
+        printf("  %8zu %10.2f %10.2f", words * NBITS(a[0]),
+               bench_row(popcount_xor_words, words, a, b),
+               bench_row(popcount_xor, words, a, b));
+#ifdef GEISTEN_X86_64
+        if (geisten_cpu_has(GEISTEN_CPU_AVX2)) {
+            printf(" %10.2f", bench_row(popcount_xor_avx2, words, a, b));
+        }
+#endif
+        printf("\n");
+    }
+}
+
+static void bench_dense() {
+    enum { N = 4096, M = 1024, WORDS = N / 64, ROUNDS = 200 };
+    static unsigned long long w[M * WORDS], x[WORDS];
+    static int y[M];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = random_word(); }
+    printf("dense() %dx%d - all supported variants\n", M, N);
+    foreach_kernels(name) {
+        double start = now_ns();
+        foreach_to(r, ROUNDS) {
+            dense(N, M, w, x, y);
+            __asm__ volatile("" : : "r"(y) : "memory");
+        }
+        double ns = now_ns() - start;
+        printf("  %-24s %8.1f binary GOPS\n", name, 2.0 * N * M * ROUNDS / ns);
+    }
+}
+
+static void bench_dense_binarize() {
+    enum { N = 4096, M = 4096, WORDS = N / 64, ROUNDS = 50 };
+    static unsigned long long w[M * WORDS], x[WORDS], bits[M / 64];
+    static int y[M], threshold[M];
+    static int8_t sign[M];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = random_word(); }
+    foreach (j, sign) {
+        threshold[j] = N / 2;
+        sign[j]      = 1;
+    }
+    printf("dense_binarize() %dx%d - layers/s\n", M, N);
+    double start = now_ns();
+    foreach_to(r, ROUNDS) {
+        dense(N, M, w, x, y);
+        /* y[j] >= N - 2 threshold[j] for the signs 1 */
+        foreach (j, y) { binarize_at_pos(bits, j, y, N - 2 * threshold[j]); }
+        __asm__ volatile("" : : "r"(bits) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "dense, binarize_at_pos",
+           1e9 * ROUNDS / (now_ns() - start));
+    start = now_ns();
+    foreach_to(r, ROUNDS) {
+        dense_binarize(N, M, w, x, threshold, sign, bits);
+        __asm__ volatile("" : : "r"(bits) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "dense_binarize",
+           1e9 * ROUNDS / (now_ns() - start));
+}
+
+static void bench_dense_scaled() {
+    enum { N = 512, M = 4096, WORDS = N / 64, ROUNDS = 500 };
+    static unsigned long long w[M * WORDS], x[WORDS];
+    static int y[M];
+    static float alpha[M], out[M];
+    static int32_t scale[M];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = random_word(); }
+    foreach (j, alpha) { alpha[j] = (random() % 1000 + 1) / 1000.0f; }
+    scale_quantize(M, alpha, 16, scale);
+    printf("dense_scaled() %dx%d - layers/s\n", M, N);
+    double start = now_ns();
+    foreach_to(r, ROUNDS) {
+        dense(N, M, w, x, y);
+        foreach (j, y) { out[j] = alpha[j] * (float)y[j]; }
+        __asm__ volatile("" : : "r"(out) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "dense, float epilogue",
+           1e9 * ROUNDS / (now_ns() - start));
+    start = now_ns();
+    foreach_to(r, ROUNDS) {
+        dense_scaled(N, M, w, x, scale, 16, y);
+        __asm__ volatile("" : : "r"(y) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "dense_scaled",
+           1e9 * ROUNDS / (now_ns() - start));
+}
+
+static void bench_dense_bitplanes() {
+    enum { N = 32 * 32 * 3, M = 256, WORDS = N / 64, ROUNDS = 100 };
+    static unsigned long long w[M * WORDS], planes[8 * WORDS];
+    static int8_t x[N], weights[M * N];
+    static int y[M];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = (int8_t)random(); }
+    foreach (i, weights) { weights[i] = random() & 1 ? 1 : -1; }
+    printf("dense_bitplanes_i8() %dx%d - layers/s\n", M, N);
+    double start = now_ns();
+    foreach_to(r, ROUNDS) {
+        foreach_to(j, M) {
+            int sum = 0;
+            foreach_to(i, N) { sum += x[i] * weights[j * N + i]; }
+            y[j] = sum;
+        }
+        __asm__ volatile("" : : "r"(y) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "int8 weights",
+           1e9 * ROUNDS / (now_ns() - start));
+    foreach_kernels(name) {
+        start = now_ns();
+        foreach_to(r, ROUNDS) {
+            bitplanes_i8(N, x, planes);
+            dense_bitplanes_i8(N, M, w, planes, y);
+            __asm__ volatile("" : : "r"(y) : "memory");
+        }
+        printf("  %-24s %8.0f\n", name, 1e9 * ROUNDS / (now_ns() - start));
+    }
+}
+
+static void bench_transpose_bits() {
+    enum { N = 1024, WORDS = N / 64, ROUNDS = 100 }; /* 1M weights */
+    static unsigned long long src[N * WORDS], dst[N * WORDS];
+    foreach (i, src) { src[i] = random_word(); }
+    printf("transpose_bits() %dx%d - ms\n", N, N);
+    double start = now_ns();
+    foreach_to(r, N) {
+        foreach_to(c, N) {
+            const unsigned long long* row = src + r * WORDS;
+            unsigned long long* col       = dst + c * WORDS;
+            col[WORDS_INDEX(col, r)] =
+                binarize(col[WORDS_INDEX(col, r)], WORDS_POS(col, r), 1ULL,
+                         (row[WORDS_INDEX(row, c)] >> WORDS_POS(row, c)) & 1);
+        }
+    }
+    __asm__ volatile("" : : "r"(dst) : "memory");
+    printf("  %-24s %8.3f\n", "binarize per bit", (now_ns() - start) / 1e6);
+    foreach_kernels(name) {
+        start = now_ns();
+        foreach_to(r, ROUNDS) {
+            transpose_bits(N, N, src, dst);
+            __asm__ volatile("" : : "r"(dst) : "memory");
+        }
+        printf("  %-24s %8.3f\n", name, (now_ns() - start) / 1e6 / ROUNDS);
+    }
+}
+
+static void bench_conv2d() {
+    struct conv2d conv = {.height   = 30,
+                          .width    = 30,
+                          .channels = 256,
+                          .filters  = 256,
+                          .kernel_h = 3,
+                          .kernel_w = 3};
+    enum { PIXEL = 256 / 64, ROUNDS = 5 };
+    static unsigned long long x[30 * 30 * PIXEL], w[256 * 3 * 3 * PIXEL];
+    static int y[28 * 28 * 256];
+    foreach (i, x) { x[i] = random_word(); }
+    foreach (i, w) { w[i] = random_word(); }
+    double ops = 2.0 * ARRAY_LENGTH(y) * 3 * 3 * conv.channels * ROUNDS;
+    printf("conv2d() 28x28x256, 3x3x256 filters - binary GOPS\n");
+    foreach_kernels(name) {
+        double start = now_ns();
+        foreach_to(r, ROUNDS) {
+            conv2d(&conv, x, w, y);
+            __asm__ volatile("" : : "r"(y) : "memory");
+        }
+        printf("  %-24s %8.1f\n", name, ops / (now_ns() - start));
+    }
+}
+
+static void bench_conv2d_strided() {
+    struct conv2d conv = {.height   = 56,
+                          .width    = 56,
+                          .channels = 256,
+                          .filters  = 256,
+                          .kernel_h = 3,
+                          .kernel_w = 3,
+                          .padding  = 1};
+    enum { PIXEL = 256 / 64, ROUNDS = 5 };
+    static unsigned long long x[56 * 56 * PIXEL], w[256 * 3 * 3 * PIXEL];
+    static int y[56 * 56 * 256];
+    foreach (i, x) { x[i] = random_word(); }
+    foreach (i, w) { w[i] = random_word(); }
+    printf("conv2d() 56x56x256, 3x3x256 filters - layers/s\n");
+    struct {
+        const char* name;
+        size_t stride, dilation;
+    } layers[] = {{"stride 1", 1, 1}, {"stride 2", 2, 1}, {"dilation 2", 1, 2}};
+    foreach (l, layers) {
+        conv.stride   = layers[l].stride;
+        conv.dilation = layers[l].dilation;
+        conv.padding  = layers[l].dilation;
+        double start  = now_ns();
+        foreach_to(r, ROUNDS) {
+            conv2d(&conv, x, w, y);
+            __asm__ volatile("" : : "r"(y) : "memory");
+        }
+        printf("  %-24s %8.1f\n", layers[l].name,
+               1e9 * ROUNDS / (now_ns() - start));
+    }
+}
+
+static void bench_conv2d_im2col() {
+    struct conv2d conv = {.height   = 68,
+                          .width    = 68,
+                          .channels = 16,
+                          .filters  = 64,
+                          .kernel_h = 5,
+                          .kernel_w = 5};
+    enum { K = 5 * 5 * 16, ROUNDS = 5 };
+    static unsigned long long x[68 * 68], w[64 * 5 * 5], packed[64 * K / 64];
+    static int y[64 * 64 * 64];
+    foreach (i, x) { x[i] = random_word(); }
+    foreach (i, w) { w[i] = random_word(); }
+    conv2d_im2col_pack(&conv, w, packed);
+    double ops = 2.0 * ARRAY_LENGTH(y) * K * ROUNDS;
+    printf("conv2d_im2col() 64x64x64, 5x5x16 filters - binary GOPS\n");
+    printf("  %-8s %10s %10s\n", "", "direct", "im2col");
+    foreach_kernels(name) {
+        double start = now_ns();
+        foreach_to(r, ROUNDS) {
+            conv2d(&conv, x, w, y);
+            __asm__ volatile("" : : "r"(y) : "memory");
+        }
+        double direct = now_ns() - start;
+        start         = now_ns();
+        foreach_to(r, ROUNDS) {
+            conv2d_im2col(&conv, x, packed, y);
+            __asm__ volatile("" : : "r"(y) : "memory");
+        }
+        printf("  %-8s %10.1f %10.1f\n", name, ops / direct,
+               ops / (now_ns() - start));
+    }
+}
+
+static void bench_conv2d_depthwise() {
+    struct conv2d conv = {.height   = 56,
+                          .width    = 56,
+                          .channels = 256,
+                          .filters  = 256,
+                          .kernel_h = 3,
+                          .kernel_w = 3,
+                          .padding  = 1,
+                          .groups   = 256};
+    enum { PIXEL = 256 / 64, ROUNDS = 5 };
+    static unsigned long long x[56 * 56 * PIXEL], w[3 * 3 * PIXEL],
+        wg[256 * 3 * 3];
+    static int y[56 * 56 * 256];
+    foreach (i, x) { x[i] = random_word(); }
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, wg) { wg[i] = random_word(); }
+    printf("conv2d_depthwise() 56x56x256, 3x3 filters - Moutputs/s\n");
+    double start = now_ns();
+    foreach_to(r, ROUNDS) {
+        conv2d(&conv, x, wg, y);
+        __asm__ volatile("" : : "r"(y) : "memory");
+    }
+    printf("  %-24s %8.1f\n", "conv2d, 256 groups",
+           1e3 * ARRAY_LENGTH(y) * ROUNDS / (now_ns() - start));
+    start = now_ns();
+    foreach_to(r, ROUNDS) {
+        conv2d_depthwise(&conv, x, w, y);
+        __asm__ volatile("" : : "r"(y) : "memory");
+    }
+    printf("  %-24s %8.1f\n", "conv2d_depthwise",
+           1e3 * ARRAY_LENGTH(y) * ROUNDS / (now_ns() - start));
+}
+
+static void bench_residual_binarize() {
+    enum { PIXELS = 28 * 28, C = 256, PIXEL = C / 64, ROUNDS = 500 };
+    static int y[PIXELS * C];
+    static int16_t shortcut[PIXELS * C], threshold[C];
+    static unsigned long long bits[PIXELS * PIXEL];
+    foreach (i, y) { y[i] = (int)(random() % 2001) - 1000; }
+    printf("residual_binarize() 28x28x256 - blocks/s\n");
+    double start = now_ns();
+    foreach_to(r, ROUNDS) {
+        foreach (i, y) {
+            int v       = shortcut[i] + y[i];
+            shortcut[i] = (int16_t)(v > INT16_MAX   ? INT16_MAX
+                                    : v < INT16_MIN ? INT16_MIN
+                                                    : v);
+        }
+        foreach_to(p, PIXELS) {
+            binarize_i16(C, shortcut + p * C, threshold, bits + p * PIXEL);
+        }
+        __asm__ volatile("" : : "r"(bits), "r"(shortcut) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "add, binarize_i16",
+           1e9 * ROUNDS / (now_ns() - start));
+    start = now_ns();
+    foreach_to(r, ROUNDS) {
+        residual_binarize(PIXELS, C, y, shortcut, threshold, bits);
+        __asm__ volatile("" : : "r"(bits), "r"(shortcut) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "residual_binarize",
+           1e9 * ROUNDS / (now_ns() - start));
+}
+
+static void bench_dense_i8() {
+    enum { N = 1024, M = 1000, ROUNDS = 500 };
+    static int8_t w[M * N], x[N];
+    static int32_t y[M];
+    foreach (i, w) { w[i] = (int8_t)(random() % 255 - 127); }
+    foreach (i, x) { x[i] = (int8_t)(random() % 255 - 127); }
+    printf("dense_i8() %dx%d - GMAC/s\n", M, N);
+    foreach_kernels(name) {
+        double start = now_ns();
+        foreach_to(r, ROUNDS) {
+            dense_i8(N, M, w, x, NULL, y);
+            __asm__ volatile("" : : "r"(y) : "memory");
+        }
+        double ns = now_ns() - start;
+        printf("  %-24s %8.1f\n", name, 1.0 * N * M * ROUNDS / ns);
+    }
+}
+
+static void bench_conv1d_stream() {
+    enum { C = 256, F = 64, K = 8, WINDOW = 49, PIXEL = C / 64, ROUNDS = 2000 };
+    struct conv2d conv = {.height   = 1,
+                          .width    = WINDOW,
+                          .channels = C,
+                          .filters  = F,
+                          .kernel_h = 1,
+                          .kernel_w = K};
+    static unsigned long long x[WINDOW * PIXEL], w[F * K * PIXEL];
+    static int y[(WINDOW - K + 1) * F];
+    foreach (i, x) { x[i] = random_word(); }
+    foreach (i, w) { w[i] = random_word(); }
+    printf("conv1d_stream_push() %d frames of %dx%d - frames/s\n", WINDOW, C,
+           K);
+    double start = now_ns();
+    foreach_to(r, ROUNDS) {
+        conv2d(&conv, x, w, y);
+        __asm__ volatile("" : : "r"(y) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "conv2d of the window",
+           1e9 * ROUNDS / (now_ns() - start));
+    struct conv1d_stream s = conv1d_stream_alloc(C, F, K);
+    start                  = now_ns();
+    foreach_to(r, ROUNDS) {
+        conv1d_stream_push(&s, x + r % WINDOW * PIXEL, w, y);
+        __asm__ volatile("" : : "r"(y) : "memory");
+    }
+    printf("  %-24s %8.0f\n", "conv1d_stream_push",
+           1e9 * ROUNDS / (now_ns() - start));
+    conv1d_stream_free(&s);
+}
+
+static void bench_maxpool2d() {
+    enum { H = 112, C = 256, PIXEL = C / 64, ROUNDS = 200 };
+    static unsigned long long x[H * H * PIXEL], y[H / 2 * H / 2 * PIXEL];
+    foreach (i, x) { x[i] = random_word(); }
+    printf("maxpool2d() %dx%dx%d, 2x2 windows - GB/s read\n", H, H, C);
+    foreach_kernels(name) {
+        double start = now_ns();
+        foreach_to(r, ROUNDS) {
+            maxpool2d(H, H, C, 2, 2, x, y);
+            __asm__ volatile("" : : "r"(y) : "memory");
+        }
+        printf("  %-24s %8.1f\n", name,
+               (double)sizeof(x) * ROUNDS / (now_ns() - start));
+    }
+}
+
+static void bench_popcount_soft() {
+    static unsigned long long x[BENCH_WORDS];
+    foreach (i, x) { x[i] = random_word(); }
+    struct {
+        const char* name;
+        int (*count)(unsigned long long);
+    } variants[] = {
+        {"kernighan", popcountll_kernighan},
+        {"swar", popcountll_swar},
+        {"table8", popcountll_table8},
+        {"table16", popcountll_table16},
+    };
+    size_t fastest = 0;
+    double best    = 0;
+    printf("popcountll_soft() - variants of GEISTEN_POPCOUNT_SOFT\n");
+    foreach (k, variants) {
+        double start = now_ns();
+        long long sum = 0;
+        foreach_to(r, BENCH_ROUNDS) {
+            foreach (i, x) { sum += variants[k].count(x[i]); }
+            __asm__ volatile("" : "+r"(variants[k].count) : : "memory");
+        }
+        double rate = 1e3 * BENCH_WORDS * BENCH_ROUNDS / (now_ns() - start);
+        bench_sink  = sum;
+        printf("  %-24s %8.1f Mwords/s\n", variants[k].name, rate);
+        if (rate > best) {
+            best    = rate;
+            fastest = k;
+        }
+    }
+    printf("  fastest: -DGEISTEN_POPCOUNT_SOFT=%s\n", variants[fastest].name);
+}
+
+/* The naive loop: one linear_n() per output, all weights per sample */
+static void gemm_naive(size_t k, size_t m, size_t n,
+                       const unsigned long long a[],
+                       const unsigned long long b[], int c[]) {
+    size_t stride = WORDS_LEN(a, k);
+    foreach_to(j, n) {
+        foreach_to(i, m) {
+            c[i * n + j] = linear_n(k, a + i * stride, b + j * stride);
+        }
+    }
+}
+
+static void bench_gemm_xnor() {
+    enum { K = 4096, M = 4096, N = 64, WORDS = K / 64, ROUNDS = 3 };
+    static unsigned long long a[M * WORDS], b[N * WORDS];
+    static int c[M * N];
+    foreach (i, a) { a[i] = random_word(); }
+    foreach (i, b) { b[i] = random_word(); }
+    printf("gemm_xnor() %dx%dx%d - binary GOPS\n", M, N, K);
+    foreach_kernels(name) {
+        double start = now_ns();
+        foreach_to(r, ROUNDS) {
+            gemm_naive(K, M, N, a, b, c);
+            __asm__ volatile("" : : "r"(c) : "memory");
+        }
+        double naive = now_ns() - start;
+        start        = now_ns();
+        foreach_to(r, ROUNDS) {
+            gemm_xnor(K, M, N, a, b, c);
+            __asm__ volatile("" : : "r"(c) : "memory");
+        }
+        double blocked = now_ns() - start;
+        printf("  %-8s naive %8.1f   blocked %8.1f\n", name,
+               2.0 * K * M * N * ROUNDS / naive,
+               2.0 * K * M * N * ROUNDS / blocked);
+    }
+}
+
+static void bench_dense_batch() {
+    enum { N = 8192, M = 32768, WORDS = N / 64, MAX_BATCH = 256 };
+    static unsigned long long w[M * WORDS], x[MAX_BATCH * WORDS];
+    static int y[MAX_BATCH * M];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = random_word(); }
+    /* 32 MB of weights: more than the last level cache */
+    printf("dense_batch() %dx%d - samples/s\n", M, N);
+    printf("  %-8s %8s %12s %12s\n", "", "batch", "dense", "dense_batch");
+    foreach_kernels(name) {
+        for (size_t batch = 1; batch <= MAX_BATCH; batch *= 4) {
+            size_t rounds = 1 + 64 / batch;
+            double start  = now_ns();
+            foreach_to(r, rounds) {
+                foreach_to(s, batch) {
+                    dense(N, M, w, x + s * WORDS, y + s * M);
+                }
+                __asm__ volatile("" : : "r"(y) : "memory");
+            }
+            double single = now_ns() - start;
+            start         = now_ns();
+            foreach_to(r, rounds) {
+                dense_batch(N, M, batch, w, x, y);
+                __asm__ volatile("" : : "r"(y) : "memory");
+            }
+            double batched = now_ns() - start;
+            printf("  %-8s %8zu %12.0f %12.0f\n", name, batch,
+                   1e9 * batch * rounds / single,
+                   1e9 * batch * rounds / batched);
+        }
+    }
+}
+
+static void bench_binarize_i8() {
+    enum { N = 224 * 224 * 3, ROUNDS = 100 }; /* an RGB image */
+    static int8_t x[N], threshold[N];
+    static unsigned long long bits[N / 64];
+    foreach (i, x) {
+        x[i]         = (int8_t)random();
+        threshold[i] = (int8_t)random();
+    }
+    printf("binarize_i8() %d elements - Melements/s\n", N);
+    double start = now_ns();
+    foreach_to(r, ROUNDS) {
+        foreach (i, x) { binarize_at_pos(bits, i, x, threshold[i]); }
+        __asm__ volatile("" : : "r"(bits) : "memory");
+    }
+    printf("  %-24s %8.1f\n", "binarize_at_pos",
+           1e3 * N * ROUNDS / (now_ns() - start));
+    foreach_kernels(name) {
+        start = now_ns();
+        foreach_to(r, ROUNDS) {
+            binarize_i8(N, x, threshold, bits);
+            __asm__ volatile("" : : "r"(bits) : "memory");
+        }
+        printf("  %-24s %8.1f\n", name, 1e3 * N * ROUNDS / (now_ns() - start));
+    }
+}
+
+int main() {
+    srandom(42);
+    bench_linear();
+    bench_popcount_soft();
+    bench_popcount_xor();
+    bench_dense();
+    bench_dense_binarize();
+    bench_dense_scaled();
+    bench_gemm_xnor();
+    bench_dense_batch();
+    bench_binarize_i8();
+    bench_dense_bitplanes();
+    bench_transpose_bits();
+    bench_conv2d();
+    bench_conv2d_strided();
+    bench_conv2d_im2col();
+    bench_conv2d_depthwise();
+    bench_residual_binarize();
+    bench_dense_i8();
+    bench_conv1d_stream();
+    bench_maxpool2d();
+    return EXIT_SUCCESS;
+}
@@ -23,10 +23,18 @@
 
 #pragma once
 
+#include <assert.h>
 #include <limits.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GEISTEN_X86_64 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
 /**
  * ## Functions
@@ -50,6 +58,23 @@
 #define WORDS_INDEX(_w, _i) ((_i) / NBITS((_w)[0]))
 #define WORDS_POS(_w, _i) ((_i) % NBITS((_w)[0]))
 
+/**
+ * ### WORDS_LEN() - Returns the number of words of array `_w` needed to store `_n` bits
+ */
+#define WORDS_LEN(_w, _n) (((_n) + NBITS((_w)[0]) - 1) / NBITS((_w)[0]))
+
+/**
+ * ### tail_mask() - Returns the mask of the valid bits in the last word of a `n` bit array
+ * - `n` The number of bits of the array
+ *
+ * The padding bits above position `n` of the last word are zero in the mask. If
+ * `n` is a multiple of the word size, all bits are valid.
+ */
+static inline unsigned long long tail_mask(size_t n) {
+    unsigned r = n % NBITS(unsigned long long);
+    return r ? (1ULL << r) - 1 : ~0ULL;
+}
+
 /**
  * ### foreach() - The foreach loop macro.
  * - `_a` The index of the current array element
@@ -65,6 +90,23 @@
  */
 #define foreach_to(_a, _b) for (size_t _a = 0; _a < (_b); _a++)
 
+/**
+ * ### word128, word256 - Vector words of 128 and 256 bits.
+ *
+ * The vector words can be used everywhere a word type is expected: `NBITS()`,
+ * `WORDS_INDEX()`, `WORDS_POS()`, `binarize()`, `binarize_at_pos()`,
+ * `popcount()` and `linear()` process the whole vector at once. Bit `i` of a
+ * vector word is bit `i % 64` of its 64 bit lane `i / 64`, so an array of
+ * vector words has the same memory layout as an `unsigned long long` array.
+ *
+ * ```
+ * word256 x[WORDS_LEN(x, 1000)];
+ * foreach_to(i, 1000) { binarize_at_pos(x, i, input, threshold); }
+ * ```
+ */
+typedef unsigned long long word128 __attribute__((vector_size(16)));
+typedef unsigned long long word256 __attribute__((vector_size(32)));
+
 /**
  * ### WORD_ONE() - standard word with first bit set.
  * - `_b` The word type
@@ -76,6 +118,26 @@
              unsigned int : 1U, unsigned long int : 1LU, \
              unsigned long long int : 1LLU, default : 1U)
 
+/**
+ * ### WORD_BIT() - Returns a word of the type of `_b` with only bit `_i` set.
+ * - `_b` The word
+ * - `_i` The position of the bit within the word
+ *
+ * The vector words are built by comparing the lane indices with the lane of
+ * bit `_i`; no function takes or returns a vector word by value, which would
+ * depend on the AVX calling convention.
+ */
+#define WORD_BIT(_b, _i)                                                        \
+    _Generic((_b), word128                                                      \
+             : ((word128)((word128){0, 1} == (unsigned long long)((_i) / 64)) & \
+                (1ULL << ((_i) % 64))),                                         \
+               word256                                                          \
+             : ((word256)((word256){0, 1, 2, 3} ==                              \
+                          (unsigned long long)((_i) / 64)) &                    \
+                (1ULL << ((_i) % 64))),                                         \
+               default                                                          \
+             : (WORD_ONE(_b) << ((_i) % NBITS(WORD_ONE(_b)))))
+
 /**
  * ### binarize() - Binarize the value `v` at position `i` and write the result in `w`.
  * - `_w` The binary word
@@ -87,9 +149,8 @@
  * if _v > _t then set bit=1 else set bit=0
  * ```
  */
-#define binarize(_w, _i, _t, _v)                     \
-    (((_v) >= (_t)) ? ((_w) | (WORD_ONE(_w) << (_i))) \
-                   : ((_w) & ~(WORD_ONE(_w) << (_i))))
+#define binarize(_w, _i, _t, _v) \
+    (((_v) >= (_t)) ? ((_w) | WORD_BIT(_w, _i)) : ((_w) & ~WORD_BIT(_w, _i)))
 
 /**
  * ### binarize_at_pos() - Binarize the value `v` at position `i` and write the result into array `w`.
@@ -110,49 +171,572 @@
         binarize((_w)[WORDS_INDEX((_w), (_i))], WORDS_POS((_w), (_i)), (_t), \
                  (_x)[(_i)]);
 
+/**
+ * ## Bit matrices
+ *
+ * A `struct bit_matrix` describes `rows` packed bit rows of `bits` valid bits
+ * each. Row `i` starts at word `i * stride`; the bits of a row beyond `bits`
+ * are padding and `tail` masks the valid bits of its last word. A bit vector
+ * is a matrix with one row. The kernels take `words` and `bits` of matrices
+ * with `stride == WORDS_LEN(words, bits)`, which is the stride of
+ * `bit_matrix_alloc()` and `bit_matrix_wrap()`.
+ *
+ * ```
+ * unsigned long long w[10 * 2];
+ * struct bit_matrix weights = bit_matrix_wrap(10, 100, w); // no copy
+ * struct bit_matrix x       = bit_matrix_alloc(1, 100);
+ * dense(weights.bits, weights.rows, weights.words, x.words, y);
+ * bit_matrix_free(&x);
+ * ```
+ */
+
+/**
+ * ### BIT_MATRIX_ALIGNMENT - The alignment of allocated bit matrices in bytes
+ *
+ * The size of a cache line and of an AVX-512 register.
+ */
+#define BIT_MATRIX_ALIGNMENT 64
+
+struct bit_matrix {
+    unsigned long long* words;
+    size_t rows;             /* number of rows */
+    size_t bits;             /* valid bits of each row */
+    size_t stride;           /* words from one row to the next */
+    unsigned long long tail; /* valid bits of the last word of a row */
+};
+
+/**
+ * ### bit_matrix_wrap_stride() - A bit matrix of existing rows with a stride of `stride` words
+ * - `rows` The number of rows
+ * - `bits` The valid bits of each row
+ * - `stride` The words from one row to the next (`>= WORDS_LEN(words, bits)`)
+ * - `words` The rows, which are not copied
+ */
+static inline struct bit_matrix bit_matrix_wrap_stride(
+    size_t rows, size_t bits, size_t stride, unsigned long long words[]) {
+    return (struct bit_matrix){.words  = words,
+                               .rows   = rows,
+                               .bits   = bits,
+                               .stride = stride,
+                               .tail   = tail_mask(bits)};
+}
+
+/**
+ * ### bit_matrix_wrap() - A bit matrix of existing packed rows
+ * - `rows` The number of rows
+ * - `bits` The valid bits of each row
+ * - `words` The `rows` rows of `WORDS_LEN(words, bits)` words, not copied
+ */
+static inline struct bit_matrix bit_matrix_wrap(size_t rows, size_t bits,
+                                                unsigned long long words[]) {
+    return bit_matrix_wrap_stride(rows, bits, WORDS_LEN(words, bits), words);
+}
+
+/**
+ * ### bit_vector_wrap() - A bit vector of the existing array `words`
+ * - `bits` The number of valid bits
+ * - `words` The `WORDS_LEN(words, bits)` words, not copied
+ */
+static inline struct bit_matrix bit_vector_wrap(size_t bits,
+                                                unsigned long long words[]) {
+    return bit_matrix_wrap(1, bits, words);
+}
+
+/**
+ * ### bit_matrix_alloc() - Allocate a cleared bit matrix
+ * - `rows` The number of rows
+ * - `bits` The valid bits of each row
+ *
+ * The words are aligned to `BIT_MATRIX_ALIGNMENT` bytes and released with
+ * `bit_matrix_free()`. Return a matrix with `words == NULL` if the memory
+ * cannot be allocated.
+ */
+static inline struct bit_matrix bit_matrix_alloc(size_t rows, size_t bits) {
+    struct bit_matrix m = bit_matrix_wrap(rows, bits, NULL);
+    size_t size = rows * m.stride * sizeof(m.words[0]);
+    /* aligned_alloc() requires a multiple of the alignment */
+    size = (size + BIT_MATRIX_ALIGNMENT - 1) / BIT_MATRIX_ALIGNMENT *
+           BIT_MATRIX_ALIGNMENT;
+    m.words = aligned_alloc(BIT_MATRIX_ALIGNMENT, size ? size : 1);
+    if (m.words) memset(m.words, 0, size);
+    return m;
+}
+
+/**
+ * ### bit_matrix_free() - Release the words of a matrix of `bit_matrix_alloc()`
+ */
+static inline void bit_matrix_free(struct bit_matrix* m) {
+    free(m->words);
+    m->words = NULL;
+}
+
+/**
+ * ### bit_matrix_row() - Returns the first word of row `i`
+ */
+static inline unsigned long long* bit_matrix_row(struct bit_matrix m,
+                                                 size_t i) {
+    return m.words + i * m.stride;
+}
+
+/**
+ * ### bit_matrix_get() - Returns the bit `j` of row `i`
+ */
+static inline int bit_matrix_get(struct bit_matrix m, size_t i, size_t j) {
+    const unsigned long long* row = bit_matrix_row(m, i);
+    return (row[WORDS_INDEX(row, j)] >> WORDS_POS(row, j)) & 1;
+}
+
+/**
+ * ### bit_matrix_set() - Set the bit `j` of row `i` to `v`
+ */
+static inline void bit_matrix_set(struct bit_matrix m, size_t i, size_t j,
+                                  int v) {
+    unsigned long long* row  = bit_matrix_row(m, i);
+    row[WORDS_INDEX(row, j)] = binarize(row[WORDS_INDEX(row, j)],
+                                        WORDS_POS(row, j), 1, v);
+}
+
+/**
+ * ### bit_matrix_clear_padding() - Clear the padding bits of all rows
+ *
+ * Wrapped rows may contain garbage beyond `bits`. After the call, kernels that
+ * process whole words, e.g. `popcount_xor()`, count the valid bits only.
+ */
+static inline void bit_matrix_clear_padding(struct bit_matrix m) {
+    size_t last = WORDS_LEN(m.words, m.bits);
+    foreach_to(i, m.rows) {
+        unsigned long long* row = bit_matrix_row(m, i);
+        if (last) row[last - 1] &= m.tail;
+        memset(row + last, 0, (m.stride - last) * sizeof(row[0]));
+    }
+}
+
+/**
+ * ### bit_matrix_is_aligned() - Returns true if all rows start at `_alignment` bytes
+ */
+#define bit_matrix_is_aligned(_m, _alignment)     \
+    ((uintptr_t)(_m).words % (_alignment) == 0 && \
+     (_m).stride * sizeof((_m).words[0]) % (_alignment) == 0)
+
+/**
+ * ## CPU features
+ */
+
+/**
+ * ### geisten_cpu_features() - Returns the instruction set extensions of the running CPU.
+ *
+ * The processor is probed with `cpuid` on the first call; every following call
+ * returns the cached result. The returned value is a combination of the
+ * `GEISTEN_CPU_*` flags. On other architectures than x86-64 the function
+ * always returns `0`.
+ */
+enum geisten_cpu_feature {
+    GEISTEN_CPU_POPCNT = 1 << 0, /* SSE4.2 era POPCNT instruction */
+    GEISTEN_CPU_AVX2   = 1 << 1, /* AVX2 with OS support for the ymm state */
+};
+
+static inline unsigned geisten_cpu_features(void) {
+    static int features = -1;
+    int f               = __atomic_load_n(&features, __ATOMIC_RELAXED);
+    if (f >= 0) return (unsigned)f;
+    f = 0;
+#ifdef GEISTEN_X86_64
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        if (ecx & bit_POPCNT) f |= GEISTEN_CPU_POPCNT;
+        if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+            unsigned xcr0, xcr0_hi;
+            __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+            /* the OS saves the xmm and ymm registers on context switches */
+            if ((xcr0 & 6) == 6 &&
+                __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+                (ebx & bit_AVX2)) {
+                f |= GEISTEN_CPU_AVX2;
+            }
+        }
+    }
+#endif
+    __atomic_store_n(&features, f, __ATOMIC_RELAXED);
+    return (unsigned)f;
+}
+
+/**
+ * ### geisten_cpu_has() - Returns true if the running CPU supports feature `_f`.
+ * - `_f` One of the `GEISTEN_CPU_*` flags
+ */
+#define geisten_cpu_has(_f) ((geisten_cpu_features() & (_f)) != 0)
+
+/**
+ * ## Population count
+ *
+ * `popcount()` selects the fastest available implementation in this order:
+ *
+ * 1. The compiler builtin, if the target is known to have a native
+ *    instruction at compile time (`-mpopcnt`, `-march=native`, arm64 `cnt`).
+ * 2. On x86-64 the `popcnt` instruction if the running CPU reports it via
+ *    `cpuid`. The probe is done once per process.
+ * 3. The portable software implementation `popcountll_soft()` on targets
+ *    without a native instruction or if `GEISTEN_POPCOUNT_SOFT` is defined,
+ *    the compiler builtin otherwise.
+ *
+ * The special operator `__has_builtin` is used to test whether the symbol named
+ * by its operand is recognized as a built-in function by the compiler. Builtins
+ * are no macros, hence `#ifdef __builtin_popcountll` is always false. GCC prior
+ * to version 10 does not know `__has_builtin` but provides the popcount
+ * builtins since version 3.4.
+ */
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_popcountll)
+#define GEISTEN_HAVE_BUILTIN_POPCOUNT 1
+#endif
+#elif defined(__GNUC__)
+#define GEISTEN_HAVE_BUILTIN_POPCOUNT 1
+#endif
+
 /*
- * The special operator __has_builtin (operand) is used to test whether
- * the symbol named by its operand is recognized as a built-in function by GCC
- * in the current language and conformance mode. The __has_builtin operator by
- * itself, without any operand or parentheses, acts as a predefined macro so
- * that support for it can be tested in portable code.
+ * The builtin is an instruction on these targets (on x86-64 inside the popcnt
+ * variants selected with `cpuid`), elsewhere a libgcc/compiler-rt routine.
  */
-#ifndef __builtin_popcountll
-#define popcount_soft(_x)                      \
-    ({                                         \
-        unsigned c = 0;                        \
-        for (; (_x) != 0; (_x) &= (_x)-1) c++; \
-        c;                                     \
-    })
+#if defined(GEISTEN_HAVE_BUILTIN_POPCOUNT) && \
+    (defined(__POPCNT__) || defined(GEISTEN_X86_64) || defined(__aarch64__))
+#define GEISTEN_NATIVE_POPCOUNT 1
+#endif
+
+/**
+ * ### popcountll_soft() - Software population count for targets without a native instruction.
+ *
+ * The variant is chosen at compile time with `GEISTEN_POPCOUNT_SOFT`:
+ *
+ * - `swar` (default) The Wilkes-Wheeler-Gill bit parallel sum, 12 operations
+ *   per word independent of the data
+ * - `table8` Sum of the bit counts of each byte looked up in a 256 byte table
+ * - `table16` Sum of the bit counts of each 16 bit half word looked up in a
+ *   64 KB table, which is filled on the first call
+ * - `kernighan` One loop iteration per set bit; the runtime depends on the data
+ *
+ * `make bench` reports the fastest variant of the build machine, e.g.
+ * `CFLAGS=-DGEISTEN_POPCOUNT_SOFT=table8`. The same variant is used for
+ * `popcounti_soft()` and `popcountl_soft()`.
+ *
+ * The software count is the fallback of `popcount()` and the word count of
+ * the kernels on targets without a native instruction. Defining
+ * `GEISTEN_POPCOUNT_SOFT` on x86-64 selects it as the fallback of
+ * `popcount()` for CPUs without `popcnt`, the kernels keep the builtin.
+ */
+static inline int popcountll_kernighan(unsigned long long x) {
+    int c = 0;
+    for (; x != 0; x &= x - 1) c++;
+    return c;
+}
+
+static inline int popcounti_kernighan(unsigned x) {
+    return popcountll_kernighan(x);
+}
+
+static inline int popcountll_swar(unsigned long long x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+static inline int popcounti_swar(unsigned x) {
+    uint32_t v = x;
+    v          = v - ((v >> 1) & 0x55555555U);
+    v          = (v & 0x33333333U) + ((v >> 2) & 0x33333333U);
+    v          = (v + (v >> 4)) & 0x0F0F0F0FU;
+    return (int)((v * 0x01010101U) >> 24);
+}
 
-static int popcountll_soft(unsigned long long x) { return popcount_soft(x); }
+#define POPCOUNT_B2(n) n, n + 1, n + 1, n + 2
+#define POPCOUNT_B4(n) \
+    POPCOUNT_B2(n), POPCOUNT_B2(n + 1), POPCOUNT_B2(n + 1), POPCOUNT_B2(n + 2)
+#define POPCOUNT_B6(n) \
+    POPCOUNT_B4(n), POPCOUNT_B4(n + 1), POPCOUNT_B4(n + 1), POPCOUNT_B4(n + 2)
+
+static const uint8_t popcount_table8[256] = {
+    POPCOUNT_B6(0), POPCOUNT_B6(1), POPCOUNT_B6(1), POPCOUNT_B6(2)};
+
+#undef POPCOUNT_B6
+#undef POPCOUNT_B4
+#undef POPCOUNT_B2
+
+static inline int popcounti_table8(unsigned x) {
+    return popcount_table8[x & 0xFF] + popcount_table8[(x >> 8) & 0xFF] +
+           popcount_table8[(x >> 16) & 0xFF] + popcount_table8[(x >> 24) & 0xFF];
+}
+
+static inline int popcountll_table8(unsigned long long x) {
+    return popcounti_table8((unsigned)x) + popcounti_table8((unsigned)(x >> 32));
+}
+
+static inline const uint8_t* popcount_table16(void) {
+    static uint8_t table[1 << 16];
+    static int ready;
+    if (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) {
+        foreach (i, table) {
+            table[i] = popcount_table8[i & 0xFF] + popcount_table8[i >> 8];
+        }
+        __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+    }
+    return table;
+}
+
+static inline int popcounti_table16(unsigned x) {
+    const uint8_t* table = popcount_table16();
+    return table[x & 0xFFFF] + table[(x >> 16) & 0xFFFF];
+}
+
+static inline int popcountll_table16(unsigned long long x) {
+    const uint8_t* table = popcount_table16();
+    return table[x & 0xFFFF] + table[(x >> 16) & 0xFFFF] +
+           table[(x >> 32) & 0xFFFF] + table[x >> 48];
+}
+
+#if defined(GEISTEN_NATIVE_POPCOUNT) && !defined(GEISTEN_POPCOUNT_SOFT)
+#define GEISTEN_POPCOUNT_BUILTIN 1
+#endif
+
+#ifndef GEISTEN_POPCOUNT_SOFT
+#define GEISTEN_POPCOUNT_SOFT swar
+#endif
+
+#define GEISTEN_CONCAT_(_a, _b) _a##_b
+#define GEISTEN_CONCAT(_a, _b) GEISTEN_CONCAT_(_a, _b)
+
+#define popcountll_soft GEISTEN_CONCAT(popcountll_, GEISTEN_POPCOUNT_SOFT)
+#define popcounti_soft GEISTEN_CONCAT(popcounti_, GEISTEN_POPCOUNT_SOFT)
+
+static inline int popcountl_soft(unsigned long x) {
+    return sizeof(x) > sizeof(unsigned) ? popcountll_soft(x)
+                                        : popcounti_soft((unsigned)x);
+}
+
+#ifdef GEISTEN_POPCOUNT_BUILTIN
+#define popcountll_fallback __builtin_popcountll
+#define popcountl_fallback __builtin_popcountl
+#define popcounti_fallback __builtin_popcount
+#else
+#define popcountll_fallback popcountll_soft
+#define popcountl_fallback popcountl_soft
+#define popcounti_fallback popcounti_soft
+#endif
+
+/*
+ * The word count of the kernels. The kernels are inlined into the popcnt and
+ * AVX2 variants, which compile the builtin to the instruction.
+ */
+#ifdef GEISTEN_NATIVE_POPCOUNT
+#define popcountll_kernel __builtin_popcountll
+#else
+#define popcountll_kernel popcountll_fallback
+#endif
+
+#if defined(GEISTEN_HAVE_BUILTIN_POPCOUNT) && \
+    (defined(__POPCNT__) || defined(__aarch64__))
+#define popcountll __builtin_popcountll
+#define popcountl __builtin_popcountl
+#define popcounti __builtin_popcount
+#elif defined(GEISTEN_X86_64)
+/* Probed once: the branch on the cached flag is always predicted correctly */
+static inline int popcountll_native(unsigned long long x) {
+    if (geisten_cpu_has(GEISTEN_CPU_POPCNT)) {
+        unsigned long long c;
+        __asm__("popcntq %1, %0" : "=r"(c) : "rm"(x) : "cc");
+        return (int)c;
+    }
+    return popcountll_fallback(x);
+}
+
+static inline int popcountl_native(unsigned long x) {
+    return popcountll_native(x);
+}
+
+static inline int popcounti_native(unsigned x) {
+    if (geisten_cpu_has(GEISTEN_CPU_POPCNT)) {
+        unsigned c;
+        __asm__("popcntl %1, %0" : "=r"(c) : "rm"(x) : "cc");
+        return (int)c;
+    }
+    return popcounti_fallback(x);
+}
+
+#define popcountll popcountll_native
+#define popcountl popcountl_native
+#define popcounti popcounti_native
+#else
+#define popcountll popcountll_fallback
+#define popcountl popcountl_fallback
+#define popcounti popcounti_fallback
+#endif
+
+static inline int popcountv128(const word128* x) {
+    return popcountll((*x)[0]) + popcountll((*x)[1]);
+}
+
+static inline int popcountv256(const word256* x) {
+    return popcountll((*x)[0]) + popcountll((*x)[1]) + popcountll((*x)[2]) +
+           popcountll((*x)[3]);
+}
+
+/* The scalar word `_x`, or `0U` for vector words */
+#define WORD_SCALAR(_x) _Generic((_x), word128 : 0U, word256 : 0U, default : (_x))
+
+/**
+ * ### popcount() - Returns the number of bits set in the word `_x`.
+ * - `_x` The word of type `unsigned`, `unsigned long`, `unsigned long long`,
+ *   `word128` or `word256`
+ */
+#define popcount(_x)                                                    \
+    _Generic((_x), /* Count the number of active bits */                \
+             word128                                                    \
+             : popcountv128((const word128*)(__typeof__(_x)[1]){(_x)}), \
+               word256                                                  \
+             : popcountv256((const word256*)(__typeof__(_x)[1]){(_x)}), \
+               default                                                  \
+             : _Generic((_x), unsigned int                              \
+                        : popcounti, unsigned long int                  \
+                        : popcountl, unsigned long long int             \
+                        : popcountll, default                           \
+                        : popcounti)(WORD_SCALAR(_x)))
 
-static int popcountl_soft(unsigned long x) { return popcount_soft(x); }
+/*
+ * The scalar popcount_xor() loop. The words are counted with four independent
+ * accumulators, so the loop is bound by the load ports instead of the latency
+ * of the popcount instruction.
+ */
+static inline __attribute__((always_inline)) size_t popcount_xor_kernel(
+    size_t words, const unsigned long long a[], const unsigned long long b[]) {
+    size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0, i = 0;
+    for (; i + 4 <= words; i += 4) {
+        c0 += popcountll_kernel(a[i] ^ b[i]);
+        c1 += popcountll_kernel(a[i + 1] ^ b[i + 1]);
+        c2 += popcountll_kernel(a[i + 2] ^ b[i + 2]);
+        c3 += popcountll_kernel(a[i + 3] ^ b[i + 3]);
+    }
+    for (; i < words; i++) c0 += popcountll_kernel(a[i] ^ b[i]);
+    return c0 + c1 + c2 + c3;
+}
 
-static int popcounti_soft(unsigned x) { return popcount_soft(x); }
+static inline size_t popcount_xor_generic(size_t words,
+                                          const unsigned long long a[],
+                                          const unsigned long long b[]) {
+    return popcount_xor_kernel(words, a, b);
+}
 
-#define popcountll popcountll_soft
-#define popcountl popcountl_soft
-#define popcounti popcounti_soft
-#elif
-#define popcountll _builtin_popcountll
-#define popcountl _builtin_popcountl
-#define popcounti _builtin_popcount
+#ifdef GEISTEN_X86_64
+/* The builtin is compiled to the popcnt instruction inside this function */
+__attribute__((target("popcnt"))) static inline size_t popcount_xor_popcnt(
+    size_t words, const unsigned long long a[], const unsigned long long b[]) {
+    return popcount_xor_kernel(words, a, b);
+}
 #endif
 
-#define popcount(_x)                                     \
-    _Generic((_x), /* Count the number of active bits */ \
-             unsigned int                                \
-             : popcounti, unsigned long int              \
-             : popcountl, unsigned long long int         \
-             : popcountll, default                       \
-             : popcounti)((_x))
+/* Rows shorter than this are faster with the scalar popcnt loop */
+#define POPCOUNT_XOR_AVX2_MIN_WORDS 16
+
+#ifdef GEISTEN_X86_64
+/* Bit count of the 64 bit lanes of `v` */
+__attribute__((target("avx2"))) static inline __m256i popcount256(__m256i v) {
+    const __m256i lookup   = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3,
+                                              2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3,
+                                              1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo             = _mm256_and_si256(v, low_mask);
+    __m256i hi             = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i cnt            = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                             _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+/* carry-save adder: h:l = a + b + c */
+#define CSA256(_h, _l, _a, _b, _c)                                 \
+    do {                                                           \
+        __m256i u_ = _mm256_xor_si256((_a), (_b));                 \
+        (_h)       = _mm256_or_si256(_mm256_and_si256((_a), (_b)), \
+                                     _mm256_and_si256(u_, (_c)));  \
+        (_l)       = _mm256_xor_si256(u_, (_c));                   \
+    } while (0)
+
+#define LOAD_XOR256(_a, _b, _i)                                         \
+    _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)((_a) + (_i))), \
+                     _mm256_loadu_si256((const __m256i*)((_b) + (_i))))
+
+/**
+ * ### popcount_xor_avx2() - AVX2 Harley-Seal popcount of the xor of `a` and `b`.
+ * - `words` The number of words of both arrays
+ * - `a` The first word array
+ * - `b` The second word array
+ *
+ * The bits of 16 vectors (64 words) are summed up by a tree of carry-save
+ * adders, so only one vector popcount is needed per 16 vectors. The vector
+ * popcount looks up the bit count of each nibble with `vpshufb` and sums the
+ * bytes with `vpsadbw`.
+ * [Details](https://arxiv.org/pdf/1611.07612.pdf)
+ *
+ * Rows shorter than `POPCOUNT_XOR_AVX2_MIN_WORDS` are counted with the scalar
+ * popcnt loop. The caller must check `geisten_cpu_has(GEISTEN_CPU_AVX2)`.
+ */
+__attribute__((target("avx2,popcnt"))) static inline size_t popcount_xor_avx2(
+    size_t words, const unsigned long long a[], const unsigned long long b[]) {
+    if (words < POPCOUNT_XOR_AVX2_MIN_WORDS) {
+        return popcount_xor_kernel(words, a, b);
+    }
+    __m256i total = _mm256_setzero_si256(), ones = total, twos = total,
+            fours = total, eights = total, sixteens, twos_a, twos_b, fours_a,
+            fours_b, eights_a, eights_b;
+    size_t i = 0;
+    for (; i + 64 <= words; i += 64) {
+        CSA256(twos_a, ones, ones, LOAD_XOR256(a, b, i),
+               LOAD_XOR256(a, b, i + 4));
+        CSA256(twos_b, ones, ones, LOAD_XOR256(a, b, i + 8),
+               LOAD_XOR256(a, b, i + 12));
+        CSA256(fours_a, twos, twos, twos_a, twos_b);
+        CSA256(twos_a, ones, ones, LOAD_XOR256(a, b, i + 16),
+               LOAD_XOR256(a, b, i + 20));
+        CSA256(twos_b, ones, ones, LOAD_XOR256(a, b, i + 24),
+               LOAD_XOR256(a, b, i + 28));
+        CSA256(fours_b, twos, twos, twos_a, twos_b);
+        CSA256(eights_a, fours, fours, fours_a, fours_b);
+        CSA256(twos_a, ones, ones, LOAD_XOR256(a, b, i + 32),
+               LOAD_XOR256(a, b, i + 36));
+        CSA256(twos_b, ones, ones, LOAD_XOR256(a, b, i + 40),
+               LOAD_XOR256(a, b, i + 44));
+        CSA256(fours_a, twos, twos, twos_a, twos_b);
+        CSA256(twos_a, ones, ones, LOAD_XOR256(a, b, i + 48),
+               LOAD_XOR256(a, b, i + 52));
+        CSA256(twos_b, ones, ones, LOAD_XOR256(a, b, i + 56),
+               LOAD_XOR256(a, b, i + 60));
+        CSA256(fours_b, twos, twos, twos_a, twos_b);
+        CSA256(eights_b, fours, fours, fours_a, fours_b);
+        CSA256(sixteens, eights, eights, eights_a, eights_b);
+        total = _mm256_add_epi64(total, popcount256(sixteens));
+    }
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(eights), 3));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(fours), 2));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(twos), 1));
+    total = _mm256_add_epi64(total, popcount256(ones));
+    for (; i + 4 <= words; i += 4) {
+        total = _mm256_add_epi64(total, popcount256(LOAD_XOR256(a, b, i)));
+    }
+    size_t count = (size_t)_mm256_extract_epi64(total, 0) +
+                   (size_t)_mm256_extract_epi64(total, 1) +
+                   (size_t)_mm256_extract_epi64(total, 2) +
+                   (size_t)_mm256_extract_epi64(total, 3);
+    for (; i < words; i++) count += __builtin_popcountll(a[i] ^ b[i]);
+    return count;
+}
+
+#undef LOAD_XOR256
+#undef CSA256
+#endif
 
 /**
  * ### relu() - ReLU function
  * - `x` The function variable
  */
-static int relu(int x) { return x * (x > 0); }
+static inline int relu(int x) { return x * (x > 0); }
 
 /**
  * ### linear() - Linear linear transformation
@@ -163,9 +747,2491 @@ static int relu(int x) { return x * (x > 0); }
  *
  * `_x` and `_w` are both binary values thus  `_x ∗ _w` can be implemented with bitwise
  * operations. In each bit, the result of basic multiplication `_x × _w` is one of
- * two values {−1,1}.
+ * two values {−1,1}: equal bits multiply to 1, differing bits to −1.
  * [Details](https://arxiv.org/pdf/1909.11366.pdf)
  *
+ * Return the sum of the element wise multiplication. All bits of the word are
+ * used, see `linear_n()` for rows with padding bits.
+ */
+#define linear(_w, _x) ((int)NBITS((_x)) - 2 * popcount((_x) ^ (_w)))
+
+/**
+ * ### batchnorm_fold() - Fold batch normalization and sign into integer thresholds
+ * - `n` The number of inputs of the binary layer (valid bits of each row)
+ * - `m` The number of outputs
+ * - `gamma` The `m` scale factors of the batch normalization
+ * - `beta` The `m` offsets of the batch normalization
+ * - `mean` The `m` running means
+ * - `var` The `m` running variances
+ * - `bias` The `m` biases of the binary layer or `NULL`
+ * - `epsilon` The epsilon of the batch normalization
+ * - `threshold` The `m` resulting thresholds
+ * - `sign` The `m` resulting signs (`-1`, `0` or `1`)
+ *
+ * The activation of a binary layer followed by batch normalization and sign
+ *
+ * ```
+ * a = sign(gamma * (y + bias - mean) / sqrt(var + epsilon) + beta)
+ * ```
+ *
+ * only depends on the number of differing bits `p` of the output's row, since
+ * `y = n - 2 p`. The folding is computed once when the model is loaded. During
+ * inference the activation bit is `batchnorm_bit(p, threshold[j], sign[j])`
+ * and never leaves the integer domain. Like `binarize()`, `a = 0` sets the
+ * bit. A negative `gamma` inverts the comparison, a zero `gamma` results in a
+ * constant bit.
+ */
+static inline void batchnorm_fold(size_t n, size_t m, const float gamma[],
+                                  const float beta[], const float mean[],
+                                  const float var[], const float bias[],
+                                  float epsilon, int threshold[],
+                                  int8_t sign[]) {
+    foreach_to(j, m) {
+        if (gamma[j] == 0) {
+            sign[j]      = 0;
+            threshold[j] = beta[j] >= 0 ? 0 : -1;
+            continue;
+        }
+        /* the activation is set for y >= t (gamma > 0) or y <= t */
+        double t = mean[j] - (bias ? bias[j] : 0) -
+                   beta[j] * sqrt((double)var[j] + epsilon) / gamma[j];
+        double p = ((double)n - t) / 2;
+        /* clamped to the range of the popcount [0, n] plus one */
+        p = fmax(-1.0, fmin(p, (double)n + 1));
+        if (gamma[j] > 0) {
+            sign[j]      = 1;
+            threshold[j] = (int)floor(p);
+        } else {
+            sign[j]      = -1;
+            threshold[j] = -(int)ceil(p);
+        }
+    }
+}
+
+/**
+ * ### batchnorm_bit() - The activation bit of the popcount `_p`
+ * - `_p` The number of differing bits of weights and inputs of an output
+ * - `_threshold` The threshold of the output from `batchnorm_fold()`
+ * - `_sign` The sign of the output from `batchnorm_fold()`
+ *
+ * Return 1 if the folded batch normalization of the output is not negative.
+ */
+#define batchnorm_bit(_p, _threshold, _sign) \
+    ((int)(_sign) * (int)(_p) <= (int)(_threshold))
+
+typedef size_t (*popcount_xor_fn)(size_t words, const unsigned long long a[],
+                                  const unsigned long long b[]);
+
+/* The number of differing bits of the rows `w` and `x` with `n` elements */
+static inline __attribute__((always_inline)) size_t popcount_xor_n_kernel(
+    popcount_xor_fn popcount_xor, size_t n, const unsigned long long w[],
+    const unsigned long long x[]) {
+    size_t words = n / NBITS(w[0]);
+    size_t count = popcount_xor(words, w, x);
+    if (n % NBITS(w[0])) {
+        count += popcountll((w[words] ^ x[words]) & tail_mask(n));
+    }
+    return count;
+}
+
+static inline __attribute__((always_inline)) int linear_n_kernel(
+    popcount_xor_fn popcount_xor, size_t n, const unsigned long long w[],
+    const unsigned long long x[]) {
+    return (int)n - 2 * (int)popcount_xor_n_kernel(popcount_xor, n, w, x);
+}
+
+static inline __attribute__((always_inline)) void dense_kernel(
+    popcount_xor_fn popcount_xor, size_t n, size_t m,
+    const unsigned long long w[], const unsigned long long x[], int y[]) {
+    size_t stride = WORDS_LEN(w, n);
+    foreach_to(j, m) {
+        y[j] = linear_n_kernel(popcount_xor, n, w + j * stride, x);
+    }
+}
+
+static inline void dense_generic(size_t n, size_t m,
+                                 const unsigned long long w[],
+                                 const unsigned long long x[], int y[]) {
+    dense_kernel(popcount_xor_generic, n, m, w, x, y);
+}
+
+/*
+ * The fused dense layer: each output bit is set in a register word and every
+ * word of the result is stored once, the `int` outputs are never written.
+ */
+static inline __attribute__((always_inline)) void dense_binarize_kernel(
+    popcount_xor_fn popcount_xor, size_t n, size_t m,
+    const unsigned long long w[], const unsigned long long x[],
+    const int threshold[], const int8_t sign[], unsigned long long result[]) {
+    size_t stride = WORDS_LEN(w, n);
+    for (size_t j0 = 0; j0 < m; j0 += NBITS(result[0])) {
+        size_t len = m - j0 < NBITS(result[0]) ? m - j0 : NBITS(result[0]);
+        unsigned long long word = 0;
+        foreach_to(b, len) {
+            size_t j = j0 + b;
+            size_t p =
+                popcount_xor_n_kernel(popcount_xor, n, w + j * stride, x);
+            word |= (unsigned long long)batchnorm_bit(p, threshold[j], sign[j])
+                    << b;
+        }
+        result[j0 / NBITS(result[0])] = word;
+    }
+}
+
+static inline void dense_binarize_generic(
+    size_t n, size_t m, const unsigned long long w[],
+    const unsigned long long x[], const int threshold[], const int8_t sign[],
+    unsigned long long result[]) {
+    dense_binarize_kernel(popcount_xor_generic, n, m, w, x, threshold, sign,
+                          result);
+}
+
+#ifdef GEISTEN_X86_64
+__attribute__((target("popcnt"))) static inline void dense_binarize_popcnt(
+    size_t n, size_t m, const unsigned long long w[],
+    const unsigned long long x[], const int threshold[], const int8_t sign[],
+    unsigned long long result[]) {
+    dense_binarize_kernel(popcount_xor_popcnt, n, m, w, x, threshold, sign,
+                          result);
+}
+
+__attribute__((target("avx2,popcnt"))) static inline void dense_binarize_avx2(
+    size_t n, size_t m, const unsigned long long w[],
+    const unsigned long long x[], const int threshold[], const int8_t sign[],
+    unsigned long long result[]) {
+    dense_binarize_kernel(popcount_xor_avx2, n, m, w, x, threshold, sign,
+                          result);
+}
+
+__attribute__((target("popcnt"))) static inline void dense_popcnt(
+    size_t n, size_t m, const unsigned long long w[],
+    const unsigned long long x[], int y[]) {
+    dense_kernel(popcount_xor_popcnt, n, m, w, x, y);
+}
+
+__attribute__((target("avx2,popcnt"))) static inline void dense_avx2(
+    size_t n, size_t m, const unsigned long long w[],
+    const unsigned long long x[], int y[]) {
+    dense_kernel(popcount_xor_avx2, n, m, w, x, y);
+}
+#endif
+
+/**
+ * ### scale_quantize() - Convert scale factors to Q format fixed point
+ * - `m` The number of outputs
+ * - `alpha` The `m` scale factors, e.g. the mean absolute weights of the
+ *   filters of XNOR-Net
+ * - `shift` The number of fractional bits (0 to 31)
+ * - `scale` The `m` resulting factors `round(alpha[j] * 2^shift)`
+ *
+ * The factors are saturated to the range of `int32_t`. The conversion is
+ * computed once when the model is loaded, the scaled layers never leave the
+ * integer domain.
+ */
+static inline void scale_quantize(size_t m, const float alpha[], int shift,
+                                  int32_t scale[]) {
+    foreach_to(j, m) {
+        double q = floor(ldexp((double)alpha[j], shift) + 0.5);
+        scale[j] = (int32_t)fmax((double)INT32_MIN, fmin(q, (double)INT32_MAX));
+    }
+}
+
+typedef void (*scale_q_fn)(size_t m, const int32_t scale[], int shift,
+                           int y[]);
+
+/*
+ * The scaling epilogue `y[j] = round(y[j] * scale[j] / 2^shift)`. The product
+ * is computed with 64 bits, the result is truncated to `int`.
+ */
+static inline void scale_q_generic(size_t m, const int32_t scale[], int shift,
+                                   int y[]) {
+    const long long round = shift ? 1LL << (shift - 1) : 0;
+    foreach_to(j, m) {
+        y[j] = (int)(((long long)y[j] * scale[j] + round) >> shift);
+    }
+}
+
+#ifdef GEISTEN_X86_64
+/*
+ * Eight outputs per step: the 64 bit products of the even and of the odd
+ * lanes are shifted logically. For shifts up to 32, the low 32 bits of the
+ * logical shift are the same as of the arithmetic shift that AVX2 lacks.
+ */
+__attribute__((target("avx2"))) static inline void scale_q_avx2(
+    size_t m, const int32_t scale[], int shift, int y[]) {
+    const __m256i round = _mm256_set1_epi64x(shift ? 1LL << (shift - 1) : 0);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t j            = 0;
+    for (; j + 8 <= m; j += 8) {
+        __m256i a    = _mm256_loadu_si256((const __m256i*)(y + j));
+        __m256i s    = _mm256_loadu_si256((const __m256i*)(scale + j));
+        __m256i even = _mm256_mul_epi32(a, s);
+        __m256i odd  = _mm256_mul_epi32(_mm256_srli_epi64(a, 32),
+                                        _mm256_srli_epi64(s, 32));
+        even         = _mm256_srl_epi64(_mm256_add_epi64(even, round), count);
+        odd          = _mm256_srl_epi64(_mm256_add_epi64(odd, round), count);
+
+        a = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+        _mm256_storeu_si256((__m256i*)(y + j), a);
+    }
+    scale_q_generic(m - j, scale + j, shift, y + j);
+}
+#endif
+
+/*
+ * The outputs of the scaled dense layer are scaled in blocks while they are
+ * still in the L1 cache.
+ */
+#ifndef DENSE_SCALED_BLOCK
+#define DENSE_SCALED_BLOCK 64 /* outputs */
+#endif
+
+/*
+ * The blocked XNOR-GEMM. The K dimension is split into blocks of
+ * `GEMM_XNOR_KC` words and the rows of `a` into blocks of `GEMM_XNOR_MC` rows,
+ * so the K block of 4 rows of `b` and of the rows of `a` stay in the L1 cache
+ * while the tiles of a block are counted. A tile compares a row of `a` with 4
+ * rows of `b` in place; the rows of `b` that do not fill a tile are counted
+ * pair by pair with the row kernel, and the padding bits of the last word
+ * are masked at the end. The element `(i, j)` of the result is stored at
+ * `c[i * cs_i + j * cs_j]`.
+ */
+#ifndef GEMM_XNOR_KC
+#define GEMM_XNOR_KC 128 /* words of a K block: 8192 bits */
+#endif
+#ifndef GEMM_XNOR_MC
+#define GEMM_XNOR_MC 16 /* rows of an `a` block */
+#endif
+
+/*
+ * The 1x4 micro-kernel: every word of the row `a` is used by four popcounts.
+ * The 4 counters and 5 words stay in registers; tiles of 2 or 4 rows of `a`
+ * need more registers than x86-64 has and are slower.
+ */
+static inline __attribute__((always_inline)) void gemm_xnor_kernel_1x4(
+    size_t kc, const unsigned long long a[], const unsigned long long b[],
+    size_t stride, size_t count[4]) {
+    const unsigned long long *b0 = b, *b1 = b0 + stride, *b2 = b1 + stride,
+                             *b3 = b2 + stride;
+    size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    foreach_to(w, kc) {
+        unsigned long long x = a[w];
+        c0 += popcountll_kernel(x ^ b0[w]);
+        c1 += popcountll_kernel(x ^ b1[w]);
+        c2 += popcountll_kernel(x ^ b2[w]);
+        c3 += popcountll_kernel(x ^ b3[w]);
+    }
+    count[0] = c0;
+    count[1] = c1;
+    count[2] = c2;
+    count[3] = c3;
+}
+
+/* Sets all `m x n` elements of `c` with the strides `cs_i` and `cs_j` to `k` */
+static inline void gemm_xnor_init(size_t k, size_t m, size_t n, int c[],
+                                  size_t cs_i, size_t cs_j) {
+    foreach_to(i, m) {
+        foreach_to(j, n) { c[i * cs_i + j * cs_j] = (int)k; }
+    }
+}
+
+/* Subtracts the differing bits of the last word of `k % 64` bits, if any */
+static inline __attribute__((always_inline)) void gemm_xnor_tail(
+    size_t k, size_t m, size_t n, const unsigned long long a[],
+    const unsigned long long b[], int c[], size_t cs_i, size_t cs_j) {
+    size_t stride = WORDS_LEN(a, k), words = k / NBITS(a[0]);
+    if (words == stride) return;
+    foreach_to(i, m) {
+        foreach_to(j, n) {
+            c[i * cs_i + j * cs_j] -=
+                2 * popcountll_kernel((a[i * stride + words] ^
+                                       b[j * stride + words]) &
+                                      tail_mask(k));
+        }
+    }
+}
+
+/* The columns `[j0, n)` of `c`, counted pair by pair with the row kernel */
+static inline __attribute__((always_inline)) void gemm_xnor_pairs(
+    popcount_xor_fn popcount_xor, size_t k, size_t m, size_t j0, size_t n,
+    const unsigned long long a[], const unsigned long long b[], int c[],
+    size_t cs_i, size_t cs_j) {
+    size_t stride = WORDS_LEN(a, k), words = k / NBITS(a[0]);
+    for (size_t j = j0; j < n; j++) {
+        foreach_to(i, m) {
+            c[i * cs_i + j * cs_j] =
+                (int)k - 2 * (int)popcount_xor(words, a + i * stride,
+                                               b + j * stride);
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void gemm_xnor_blocked(
+    popcount_xor_fn popcount_xor, size_t k, size_t m, size_t n,
+    const unsigned long long a[], const unsigned long long b[], int c[],
+    size_t cs_i, size_t cs_j) {
+    size_t stride = WORDS_LEN(a, k), words = k / NBITS(a[0]), nt = n - n % 4;
+    gemm_xnor_init(k, m, nt, c, cs_i, cs_j);
+    for (size_t kw = 0; kw < words; kw += GEMM_XNOR_KC) {
+        size_t kc = words - kw < GEMM_XNOR_KC ? words - kw : GEMM_XNOR_KC;
+        for (size_t ib = 0; ib < m; ib += GEMM_XNOR_MC) {
+            size_t mc = m - ib < GEMM_XNOR_MC ? m - ib : GEMM_XNOR_MC;
+            for (size_t j = 0; j < nt; j += 4) {
+                const unsigned long long* bj = b + j * stride + kw;
+                for (size_t i = ib; i < ib + mc; i++) {
+                    size_t count[4];
+                    gemm_xnor_kernel_1x4(kc, a + i * stride + kw, bj, stride,
+                                         count);
+                    foreach_to(t, 4) {
+                        c[i * cs_i + (j + t) * cs_j] -= 2 * (int)count[t];
+                    }
+                }
+            }
+        }
+    }
+    gemm_xnor_pairs(popcount_xor, k, m, nt, n, a, b, c, cs_i, cs_j);
+    gemm_xnor_tail(k, m, n, a, b, c, cs_i, cs_j);
+}
+
+static inline void gemm_xnor_generic(size_t k, size_t m, size_t n,
+                                     const unsigned long long a[],
+                                     const unsigned long long b[], int c[],
+                                     size_t cs_i, size_t cs_j) {
+    gemm_xnor_blocked(popcount_xor_generic, k, m, n, a, b, c, cs_i, cs_j);
+}
+
+#ifdef GEISTEN_X86_64
+__attribute__((target("popcnt"))) static inline void gemm_xnor_popcnt(
+    size_t k, size_t m, size_t n, const unsigned long long a[],
+    const unsigned long long b[], int c[], size_t cs_i, size_t cs_j) {
+    gemm_xnor_blocked(popcount_xor_popcnt, k, m, n, a, b, c, cs_i, cs_j);
+}
+
+/* Rows shorter than this are faster with the scalar tile */
+#define GEMM_XNOR_AVX2_MIN_WORDS 64
+
+/*
+ * The 1x4 scalar tile is bound by the popcnt port. With AVX2 the Harley-Seal
+ * row kernel counts rows of at least one block of 64 words faster than the
+ * tile, so their cache blocks are counted pair by pair.
+ */
+__attribute__((target("avx2,popcnt"))) static inline void gemm_xnor_avx2(
+    size_t k, size_t m, size_t n, const unsigned long long a[],
+    const unsigned long long b[], int c[], size_t cs_i, size_t cs_j) {
+    size_t stride = WORDS_LEN(a, k), words = k / NBITS(a[0]);
+    if (words < GEMM_XNOR_AVX2_MIN_WORDS) {
+        gemm_xnor_blocked(popcount_xor_avx2, k, m, n, a, b, c, cs_i, cs_j);
+        return;
+    }
+    gemm_xnor_init(k, m, n, c, cs_i, cs_j);
+    for (size_t kw = 0; kw < words; kw += GEMM_XNOR_KC) {
+        size_t kc = words - kw < GEMM_XNOR_KC ? words - kw : GEMM_XNOR_KC;
+        for (size_t ib = 0; ib < m; ib += GEMM_XNOR_MC) {
+            size_t mc = m - ib < GEMM_XNOR_MC ? m - ib : GEMM_XNOR_MC;
+            foreach_to(j, n) {
+                const unsigned long long* bj = b + j * stride + kw;
+                for (size_t i = ib; i < ib + mc; i++) {
+                    c[i * cs_i + j * cs_j] -= 2 * (int)popcount_xor_avx2(
+                                                  kc, a + i * stride + kw, bj);
+                }
+            }
+        }
+    }
+    gemm_xnor_tail(k, m, n, a, b, c, cs_i, cs_j);
+}
+#endif
+
+/*
+ * The binarizers compare a whole word of inputs with their thresholds and
+ * store every output word exactly once. A word kernel returns the bits of 64
+ * elements: the portable one builds the word in a register, on x86-64 the SSE2
+ * baseline compares 4 to 16 and AVX2 8 to 32 elements per instruction and
+ * collects the comparison results with movemask. The unsigned types are
+ * compared as signed after flipping their sign bits.
+ *
+ * A scalar threshold is broadcast into a buffer of 64 elements which is
+ * passed as threshold of every word.
+ */
+#define BINARIZE_WORD(_len, _x, _t)                                    \
+    ({                                                                 \
+        unsigned long long word_ = 0;                                  \
+        foreach_to(b_, (_len)) {                                       \
+            word_ |= (unsigned long long)((_x)[b_] >= (_t)[b_]) << b_; \
+        }                                                              \
+        word_;                                                         \
+    })
+
+#define BINARIZE_ROWS(_word, _n, _x, _t, _t_step, _result)                \
+    do {                                                                  \
+        size_t words_ = (_n) / 64, i_ = 0;                                \
+        for (; i_ < words_; i_++) {                                       \
+            (_result)[i_] = _word((_x) + i_ * 64, (_t) + i_ * (_t_step)); \
+        }                                                                 \
+        if ((_n) % 64) {                                                  \
+            (_result)[i_] = BINARIZE_WORD((_n) % 64, (_x) + i_ * 64,      \
+                                          (_t) + i_ * (_t_step));         \
+        }                                                                 \
+    } while (0)
+
+#define BINARIZE_DEFINE(_name, _type, _word, _attr)                        \
+    _attr static inline void _name(size_t n, const _type x[],              \
+                                   const _type threshold[],                \
+                                   unsigned long long result[]) {          \
+        BINARIZE_ROWS(_word, n, x, threshold, 64, result);                 \
+    }                                                                      \
+    _attr static inline void _name##_scalar(size_t n, const _type x[],     \
+                                            _type threshold,               \
+                                            unsigned long long result[]) { \
+        _type t[64];                                                       \
+        foreach (i, t) { t[i] = threshold; }                               \
+        BINARIZE_ROWS(_word, n, x, t, 0, result);                          \
+    }
+
+#ifdef GEISTEN_X86_64
+#define LOAD128(_p) _mm_loadu_si128((const __m128i*)(_p))
+#define LOAD256(_p) _mm256_loadu_si256((const __m256i*)(_p))
+
+static inline unsigned long long binarize_f32_word_sse2(const float x[],
+                                                        const float t[]) {
+    unsigned long long word = 0;
+    foreach_to(j, 16) {
+        __m128 ge =
+            _mm_cmpge_ps(_mm_loadu_ps(x + j * 4), _mm_loadu_ps(t + j * 4));
+        word |= (unsigned long long)_mm_movemask_ps(ge) << (j * 4);
+    }
+    return word;
+}
+
+/* 16 bits of x >= t from the 16 bit comparisons of 2 x 8 elements */
+static inline unsigned binarize_16x16_sse2(__m128i x0, __m128i x1, __m128i t0,
+                                           __m128i t1) {
+    __m128i lt =
+        _mm_packs_epi16(_mm_cmpgt_epi16(t0, x0), _mm_cmpgt_epi16(t1, x1));
+    return ~(unsigned)_mm_movemask_epi8(lt) & 0xFFFFU;
+}
+
+static inline unsigned long long binarize_i16_word_sse2(const int16_t x[],
+                                                        const int16_t t[]) {
+    unsigned long long word = 0;
+    foreach_to(j, 4) {
+        const size_t p = j * 16;
+        word |= (unsigned long long)binarize_16x16_sse2(
+                    LOAD128(x + p), LOAD128(x + p + 8), LOAD128(t + p),
+                    LOAD128(t + p + 8))
+                << p;
+    }
+    return word;
+}
+
+static inline unsigned long long binarize_u16_word_sse2(const uint16_t x[],
+                                                        const uint16_t t[]) {
+    const __m128i sign      = _mm_set1_epi16((short)0x8000);
+    unsigned long long word = 0;
+    foreach_to(j, 4) {
+        const size_t p = j * 16;
+        word |= (unsigned long long)binarize_16x16_sse2(
+                    _mm_xor_si128(LOAD128(x + p), sign),
+                    _mm_xor_si128(LOAD128(x + p + 8), sign),
+                    _mm_xor_si128(LOAD128(t + p), sign),
+                    _mm_xor_si128(LOAD128(t + p + 8), sign))
+                << p;
+    }
+    return word;
+}
+
+static inline unsigned long long binarize_i8_word_sse2(const int8_t x[],
+                                                       const int8_t t[]) {
+    unsigned long long word = 0;
+    foreach_to(j, 4) {
+        __m128i lt = _mm_cmpgt_epi8(LOAD128(t + j * 16), LOAD128(x + j * 16));
+        word |= (unsigned long long)(~(unsigned)_mm_movemask_epi8(lt) & 0xFFFFU)
+                << (j * 16);
+    }
+    return word;
+}
+
+static inline unsigned long long binarize_u8_word_sse2(const uint8_t x[],
+                                                       const uint8_t t[]) {
+    const __m128i sign      = _mm_set1_epi8((char)0x80);
+    unsigned long long word = 0;
+    foreach_to(j, 4) {
+        __m128i lt = _mm_cmpgt_epi8(_mm_xor_si128(LOAD128(t + j * 16), sign),
+                                    _mm_xor_si128(LOAD128(x + j * 16), sign));
+        word |= (unsigned long long)(~(unsigned)_mm_movemask_epi8(lt) & 0xFFFFU)
+                << (j * 16);
+    }
+    return word;
+}
+
+__attribute__((target("avx2"))) static inline unsigned long long
+binarize_f32_word_avx2(const float x[], const float t[]) {
+    unsigned long long word = 0;
+    foreach_to(j, 8) {
+        __m256 ge = _mm256_cmp_ps(_mm256_loadu_ps(x + j * 8),
+                                  _mm256_loadu_ps(t + j * 8), _CMP_GE_OQ);
+        word |= (unsigned long long)_mm256_movemask_ps(ge) << (j * 8);
+    }
+    return word;
+}
+
+/* 32 bits of x >= t from the 16 bit comparisons of 2 x 16 elements */
+__attribute__((target("avx2"))) static inline unsigned binarize_32x16_avx2(
+    __m256i x0, __m256i x1, __m256i t0, __m256i t1) {
+    __m256i lt = _mm256_packs_epi16(_mm256_cmpgt_epi16(t0, x0),
+                                    _mm256_cmpgt_epi16(t1, x1));
+    /* packs interleaves the 128 bit lanes of both operands */
+    lt = _mm256_permute4x64_epi64(lt, 0xD8);
+    return ~(unsigned)_mm256_movemask_epi8(lt);
+}
+
+__attribute__((target("avx2"))) static inline unsigned long long
+binarize_i16_word_avx2(const int16_t x[], const int16_t t[]) {
+    unsigned lo = binarize_32x16_avx2(LOAD256(x), LOAD256(x + 16), LOAD256(t),
+                                      LOAD256(t + 16));
+    unsigned hi = binarize_32x16_avx2(LOAD256(x + 32), LOAD256(x + 48),
+                                      LOAD256(t + 32), LOAD256(t + 48));
+    return (unsigned long long)hi << 32 | lo;
+}
+
+__attribute__((target("avx2"))) static inline unsigned long long
+binarize_u16_word_avx2(const uint16_t x[], const uint16_t t[]) {
+    const __m256i sign = _mm256_set1_epi16((short)0x8000);
+#define FLIP(_p) _mm256_xor_si256(LOAD256(_p), sign)
+    unsigned lo = binarize_32x16_avx2(FLIP(x), FLIP(x + 16), FLIP(t),
+                                      FLIP(t + 16));
+    unsigned hi = binarize_32x16_avx2(FLIP(x + 32), FLIP(x + 48), FLIP(t + 32),
+                                      FLIP(t + 48));
+#undef FLIP
+    return (unsigned long long)hi << 32 | lo;
+}
+
+__attribute__((target("avx2"))) static inline unsigned long long
+binarize_i8_word_avx2(const int8_t x[], const int8_t t[]) {
+    /* the sign bits of t > x, the inverse of x >= t */
+    unsigned lo = (unsigned)_mm256_movemask_epi8(
+        _mm256_cmpgt_epi8(LOAD256(t), LOAD256(x)));
+    unsigned hi = (unsigned)_mm256_movemask_epi8(
+        _mm256_cmpgt_epi8(LOAD256(t + 32), LOAD256(x + 32)));
+    return ~((unsigned long long)hi << 32 | lo);
+}
+
+__attribute__((target("avx2"))) static inline unsigned long long
+binarize_u8_word_avx2(const uint8_t x[], const uint8_t t[]) {
+    const __m256i sign = _mm256_set1_epi8((char)0x80);
+#define FLIP(_p) _mm256_xor_si256(LOAD256(_p), sign)
+    unsigned lo = (unsigned)_mm256_movemask_epi8(
+        _mm256_cmpgt_epi8(FLIP(t), FLIP(x)));
+    unsigned hi = (unsigned)_mm256_movemask_epi8(
+        _mm256_cmpgt_epi8(FLIP(t + 32), FLIP(x + 32)));
+#undef FLIP
+    return ~((unsigned long long)hi << 32 | lo);
+}
+
+#undef LOAD256
+#undef LOAD128
+
+#define BINARIZE_WORD_GENERIC(_type) binarize_##_type##_word_sse2
+#define AVX2 __attribute__((target("avx2")))
+BINARIZE_DEFINE(binarize_f32_avx2, float, binarize_f32_word_avx2, AVX2)
+BINARIZE_DEFINE(binarize_i16_avx2, int16_t, binarize_i16_word_avx2, AVX2)
+BINARIZE_DEFINE(binarize_u16_avx2, uint16_t, binarize_u16_word_avx2, AVX2)
+BINARIZE_DEFINE(binarize_i8_avx2, int8_t, binarize_i8_word_avx2, AVX2)
+BINARIZE_DEFINE(binarize_u8_avx2, uint8_t, binarize_u8_word_avx2, AVX2)
+#undef AVX2
+#else
+#define BINARIZE_WORD_GENERIC(_type) binarize_word_generic
+#define binarize_word_generic(_x, _t) BINARIZE_WORD(64, (_x), (_t))
+#endif
+
+BINARIZE_DEFINE(binarize_f32_generic, float, BINARIZE_WORD_GENERIC(f32), )
+BINARIZE_DEFINE(binarize_i16_generic, int16_t, BINARIZE_WORD_GENERIC(i16), )
+BINARIZE_DEFINE(binarize_u16_generic, uint16_t, BINARIZE_WORD_GENERIC(u16), )
+BINARIZE_DEFINE(binarize_i8_generic, int8_t, BINARIZE_WORD_GENERIC(i8), )
+BINARIZE_DEFINE(binarize_u8_generic, uint8_t, BINARIZE_WORD_GENERIC(u8), )
+
+/*
+ * The residual shortcut of a binary block (Bi-Real, ReActNet): the `int`
+ * outputs of the block are added to the `int16_t` shortcut with saturation
+ * and the sums are binarized like `binarize_i16()`. Both are fused into one
+ * pass, the sums are stored as the shortcut of the next block and compared in
+ * the registers. A word kernel handles 64 channels of a pixel.
+ */
+typedef unsigned long long (*residual_word_fn)(const int y[],
+                                               int16_t shortcut[],
+                                               const int16_t threshold[]);
+
+static inline unsigned long long residual_word_n(size_t len, const int y[],
+                                                 int16_t shortcut[],
+                                                 const int16_t threshold[]) {
+    unsigned long long word = 0;
+    foreach_to(b, len) {
+        long long v = (long long)shortcut[b] + y[b];
+        v           = v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v;
+        shortcut[b] = (int16_t)v;
+        word |= (unsigned long long)(v >= threshold[b]) << b;
+    }
+    return word;
+}
+
+static inline unsigned long long residual_word_generic(
+    const int y[], int16_t shortcut[], const int16_t threshold[]) {
+    return residual_word_n(64, y, shortcut, threshold);
+}
+
+#ifdef GEISTEN_X86_64
+/*
+ * The saturated sums of 16 outputs and their shortcut. The outputs are
+ * clamped to [-65536, 65535] first: the 32 bit add cannot wrap then, and
+ * the sums still saturate to the same `int16_t` like `residual_word_n()`.
+ */
+__attribute__((target("avx2"))) static inline __m256i residual_add_avx2(
+    const int y[], int16_t shortcut[]) {
+    const __m256i min = _mm256_set1_epi32(-65536);
+    const __m256i max = _mm256_set1_epi32(65535);
+    __m256i s  = _mm256_loadu_si256((const __m256i*)shortcut);
+    __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s));
+    __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1));
+    __m256i y0 = _mm256_loadu_si256((const __m256i*)y);
+    __m256i y1 = _mm256_loadu_si256((const __m256i*)(y + 8));
+
+    y0 = _mm256_max_epi32(_mm256_min_epi32(y0, max), min);
+    y1 = _mm256_max_epi32(_mm256_min_epi32(y1, max), min);
+    lo = _mm256_add_epi32(lo, y0);
+    hi = _mm256_add_epi32(hi, y1);
+    /* packs interleaves the 128 bit lanes of both operands */
+    s = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+    _mm256_storeu_si256((__m256i*)shortcut, s);
+    return s;
+}
+
+__attribute__((target("avx2"))) static inline unsigned long long
+residual_word_avx2(const int y[], int16_t shortcut[],
+                   const int16_t threshold[]) {
+    unsigned long long word = 0;
+    foreach_to(j, 2) {
+        __m256i s0 = residual_add_avx2(y + j * 32, shortcut + j * 32);
+        __m256i s1 = residual_add_avx2(y + j * 32 + 16, shortcut + j * 32 + 16);
+        __m256i t0 = _mm256_loadu_si256((const __m256i*)(threshold + j * 32));
+        __m256i t1 =
+            _mm256_loadu_si256((const __m256i*)(threshold + j * 32 + 16));
+        word |= (unsigned long long)binarize_32x16_avx2(s0, s1, t0, t1)
+                << (j * 32);
+    }
+    return word;
+}
+#endif
+
+static inline __attribute__((always_inline)) void residual_binarize_kernel(
+    residual_word_fn residual_word, size_t pixels, size_t channels,
+    const int y[], int16_t shortcut[], const int16_t threshold[],
+    unsigned long long result[]) {
+    const size_t words = WORDS_LEN(result, channels);
+    foreach_to(p, pixels) {
+        const int* in           = y + p * channels;
+        int16_t* sum            = shortcut + p * channels;
+        unsigned long long* out = result + p * words;
+        size_t c                = 0;
+        for (; c + 64 <= channels; c += 64) {
+            out[c / 64] = residual_word(in + c, sum + c, threshold + c);
+        }
+        if (c < channels) {
+            out[c / 64] = residual_word_n(channels - c, in + c, sum + c,
+                                          threshold + c);
+        }
+    }
+}
+
+static inline void residual_binarize_generic(size_t pixels, size_t channels,
+                                             const int y[], int16_t shortcut[],
+                                             const int16_t threshold[],
+                                             unsigned long long result[]) {
+    residual_binarize_kernel(residual_word_generic, pixels, channels, y,
+                             shortcut, threshold, result);
+}
+
+#ifdef GEISTEN_X86_64
+__attribute__((target("avx2"))) static inline void residual_binarize_avx2(
+    size_t pixels, size_t channels, const int y[], int16_t shortcut[],
+    const int16_t threshold[], unsigned long long result[]) {
+    residual_binarize_kernel(residual_word_avx2, pixels, channels, y, shortcut,
+                             threshold, result);
+}
+#endif
+
+/*
+ * The int8 dense layer of the classifier head. Row `j` of the weights is the
+ * `n` consecutive values `w[j * n]` to `w[j * n + n - 1]`.
+ */
+static inline void dense_i8_generic(size_t n, size_t m, const int8_t w[],
+                                    const int8_t x[], const int32_t bias[],
+                                    int32_t y[]) {
+    foreach_to(j, m) {
+        int32_t sum = bias ? bias[j] : 0;
+        foreach_to(i, n) { sum += (int32_t)w[j * n + i] * x[i]; }
+        y[j] = sum;
+    }
+}
+
+#ifdef GEISTEN_X86_64
+/*
+ * pmaddubsw multiplies unsigned with signed bytes, so the sign of the weight
+ * is moved to the input: |w| * (x * sign(w)). The sums of two products fit
+ * into 16 bits for values in [-127, 127]. Four rows share the loads of `x`.
+ */
+__attribute__((target("avx2"))) static inline __m256i dense_i8_madd_avx2(
+    __m256i acc, __m256i w, __m256i x) {
+    __m256i p =
+        _mm256_maddubs_epi16(_mm256_abs_epi8(w), _mm256_sign_epi8(x, w));
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(p, _mm256_set1_epi16(1)));
+}
+
+__attribute__((target("avx2"))) static inline void dense_i8_avx2(
+    size_t n, size_t m, const int8_t w[], const int8_t x[],
+    const int32_t bias[], int32_t y[]) {
+    const size_t vn = n / 32 * 32;
+    size_t j        = 0;
+    for (; j + 4 <= m; j += 4) {
+        const int8_t* r = w + j * n;
+        __m256i a0 = _mm256_setzero_si256(), a1 = a0, a2 = a0, a3 = a0;
+        for (size_t i = 0; i < vn; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(x + i));
+#define ROW(_k) _mm256_loadu_si256((const __m256i*)(r + (_k) * n + i))
+            a0 = dense_i8_madd_avx2(a0, ROW(0), v);
+            a1 = dense_i8_madd_avx2(a1, ROW(1), v);
+            a2 = dense_i8_madd_avx2(a2, ROW(2), v);
+            a3 = dense_i8_madd_avx2(a3, ROW(3), v);
+#undef ROW
+        }
+        /* the 4 row sums in the lanes of both 128 bit halves */
+        __m256i h = _mm256_hadd_epi32(_mm256_hadd_epi32(a0, a1),
+                                      _mm256_hadd_epi32(a2, a3));
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(h),
+                                    _mm256_extracti128_si256(h, 1));
+        int32_t s[4];
+        _mm_storeu_si128((__m128i*)s, sum);
+        foreach_to(k, 4) {
+            for (size_t i = vn; i < n; i++) {
+                s[k] += (int32_t)r[k * n + i] * x[i];
+            }
+            y[j + k] = s[k] + (bias ? bias[j + k] : 0);
+        }
+    }
+    dense_i8_generic(n, m - j, w + j * n, x, bias ? bias + j : NULL, y + j);
+}
+#endif
+
+/*
+ * Bit-planes of 8 bit inputs. Plane `k` holds bit `k` of every element, the
+ * 8 planes of a word of 64 elements are stored next to each other. With
+ * weights `+1` for set and `-1` for cleared bits, the dot product of the
+ * inputs and a weights row `w` is
+ *
+ *   sum_k c_k (popcount(plane_k & w) - popcount(plane_k & ~w))
+ *
+ * with `c_k = 2^k`, except `c_7 = -128` for signed inputs.
+ */
+#define BITPLANES 8
+
+static inline __attribute__((always_inline)) void bitplanes_word_generic(
+    const uint8_t x[], unsigned long long planes[]) {
+    foreach_to(k, BITPLANES) {
+        unsigned long long word = 0;
+        foreach_to(b, 64) { word |= (unsigned long long)(x[b] >> k & 1) << b; }
+        planes[k] = word;
+    }
+}
+
+#define BITPLANES_ROWS(_word, _n, _x, _planes)                        \
+    do {                                                              \
+        size_t words_ = (_n) / 64, i_ = 0;                            \
+        for (; i_ < words_; i_++) {                                   \
+            _word((_x) + i_ * 64, (_planes) + i_ * BITPLANES);        \
+        }                                                             \
+        if ((_n) % 64) {                                              \
+            uint8_t tail_[64] = {0};                                  \
+            memcpy(tail_, (_x) + i_ * 64, (_n) % 64);                 \
+            _word(tail_, (_planes) + i_ * BITPLANES);                 \
+        }                                                             \
+    } while (0)
+
+#ifdef GEISTEN_X86_64
+/* movemask collects bit 7 of every byte, adding a byte to itself shifts it */
+static inline void bitplanes_word_sse2(const uint8_t x[],
+                                       unsigned long long planes[]) {
+    memset(planes, 0, BITPLANES * sizeof(planes[0]));
+    foreach_to(j, 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(x + j * 16));
+        for (int k = BITPLANES - 1; k >= 0; k--) {
+            planes[k] |= (unsigned long long)_mm_movemask_epi8(v) << (j * 16);
+            v = _mm_add_epi8(v, v);
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static inline void bitplanes_word_avx2(
+    const uint8_t x[], unsigned long long planes[]) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)x);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(x + 32));
+    for (int k = BITPLANES - 1; k >= 0; k--) {
+        unsigned long long l = (unsigned)_mm256_movemask_epi8(lo);
+        unsigned long long h = (unsigned)_mm256_movemask_epi8(hi);
+        planes[k]            = h << 32 | l;
+        lo = _mm256_add_epi8(lo, lo);
+        hi = _mm256_add_epi8(hi, hi);
+    }
+}
+
+__attribute__((target("avx2"))) static inline void bitplanes_avx2(
+    size_t n, const uint8_t x[], unsigned long long planes[]) {
+    BITPLANES_ROWS(bitplanes_word_avx2, n, x, planes);
+}
+
+#define BITPLANES_WORD_GENERIC bitplanes_word_sse2
+#else
+#define BITPLANES_WORD_GENERIC bitplanes_word_generic
+#endif
+
+static inline void bitplanes_generic(size_t n, const uint8_t x[],
+                                     unsigned long long planes[]) {
+    BITPLANES_ROWS(BITPLANES_WORD_GENERIC, n, x, planes);
+}
+
+static inline __attribute__((always_inline)) void dense_bitplanes_kernel(
+    size_t n, size_t m, const unsigned long long w[],
+    const unsigned long long planes[], int msb, int y[]) {
+    size_t words = WORDS_LEN(w, n);
+    int total[BITPLANES] = {0};
+    foreach_to(i, words) {
+        foreach_to(k, BITPLANES) {
+            total[k] += popcountll_kernel(planes[i * BITPLANES + k]);
+        }
+    }
+    foreach_to(j, m) {
+        const unsigned long long* row = w + j * words;
+        int set[BITPLANES] = {0};
+        foreach_to(i, words) {
+            const unsigned long long* p = planes + i * BITPLANES;
+            foreach_to(k, BITPLANES) {
+                set[k] += popcountll_kernel(p[k] & row[i]);
+            }
+        }
+        int sum = 0;
+        foreach_to(k, BITPLANES - 1) {
+            sum += (2 * set[k] - total[k]) * (1 << k);
+        }
+        y[j] = sum + msb * (2 * set[BITPLANES - 1] - total[BITPLANES - 1]);
+    }
+}
+
+static inline void dense_bitplanes_generic(size_t n, size_t m,
+                                           const unsigned long long w[],
+                                           const unsigned long long planes[],
+                                           int msb, int y[]) {
+    dense_bitplanes_kernel(n, m, w, planes, msb, y);
+}
+
+#ifdef GEISTEN_X86_64
+__attribute__((target("popcnt"))) static inline void dense_bitplanes_popcnt(
+    size_t n, size_t m, const unsigned long long w[],
+    const unsigned long long planes[], int msb, int y[]) {
+    dense_bitplanes_kernel(n, m, w, planes, msb, y);
+}
+
+__attribute__((target("avx2,popcnt"))) static inline void dense_bitplanes_avx2(
+    size_t n, size_t m, const unsigned long long w[],
+    const unsigned long long planes[], int msb, int y[]) {
+    dense_bitplanes_kernel(n, m, w, planes, msb, y);
+}
+#endif
+
+/*
+ * Transpose of a 64 x 64 bit matrix: bit `c` of row `r` becomes bit `r` of
+ * row `c`. The portable kernel swaps the off-diagonal blocks of 32 x 32, then
+ * of 16 x 16 bits and so on with shifts and masks (Hacker's Delight 7-3).
+ */
+static inline void transpose64_generic(const unsigned long long src[64],
+                                       unsigned long long dst[64]) {
+    unsigned long long m = 0x00000000FFFFFFFFULL;
+    memcpy(dst, src, 64 * sizeof(dst[0]));
+    for (size_t j = 32; j; j >>= 1, m ^= m << j) {
+        for (size_t k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            unsigned long long t = ((dst[k] >> j) ^ dst[k | j]) & m;
+            dst[k] ^= t << j;
+            dst[k | j] ^= t;
+        }
+    }
+}
+
+#ifdef GEISTEN_X86_64
+/*
+ * The vector kernels transpose blocks of 8 x 8 bytes, so that a register
+ * holds the same byte of 16 or 32 rows, and collect the 8 bits of the byte
+ * with movemask like the bit-planes. `col[i]` holds the bytes `2 i` (low half)
+ * and `2 i + 1` (high half) of the 8 rows.
+ */
+static inline void transpose_8x8_bytes_sse2(const unsigned long long src[8],
+                                            __m128i col[4]) {
+    __m128i a  = _mm_loadu_si128((const __m128i*)src);
+    __m128i b  = _mm_loadu_si128((const __m128i*)(src + 2));
+    __m128i c  = _mm_loadu_si128((const __m128i*)(src + 4));
+    __m128i d  = _mm_loadu_si128((const __m128i*)(src + 6));
+    __m128i t0 = _mm_unpacklo_epi8(a, b); /* rows 0, 2 */
+    __m128i t1 = _mm_unpackhi_epi8(a, b); /* rows 1, 3 */
+    __m128i t2 = _mm_unpacklo_epi8(c, d); /* rows 4, 6 */
+    __m128i t3 = _mm_unpackhi_epi8(c, d); /* rows 5, 7 */
+    __m128i u0 = _mm_unpacklo_epi8(t0, t1); /* bytes 0-3 of rows 0-3 */
+    __m128i u1 = _mm_unpackhi_epi8(t0, t1); /* bytes 4-7 of rows 0-3 */
+    __m128i u2 = _mm_unpacklo_epi8(t2, t3); /* bytes 0-3 of rows 4-7 */
+    __m128i u3 = _mm_unpackhi_epi8(t2, t3); /* bytes 4-7 of rows 4-7 */
+    col[0]     = _mm_unpacklo_epi32(u0, u2);
+    col[1]     = _mm_unpackhi_epi32(u0, u2);
+    col[2]     = _mm_unpacklo_epi32(u1, u3);
+    col[3]     = _mm_unpackhi_epi32(u1, u3);
+}
+
+static inline void transpose64_sse2(const unsigned long long src[64],
+                                    unsigned long long dst[64]) {
+    memset(dst, 0, 64 * sizeof(dst[0]));
+    foreach_to(h, 4) {
+        __m128i a[4], b[4];
+        transpose_8x8_bytes_sse2(src + h * 16, a);
+        transpose_8x8_bytes_sse2(src + h * 16 + 8, b);
+        foreach_to(i, 8) {
+            /* byte i of the rows 16 h to 16 h + 15 */
+            __m128i v = i % 2 ? _mm_unpackhi_epi64(a[i / 2], b[i / 2])
+                              : _mm_unpacklo_epi64(a[i / 2], b[i / 2]);
+            for (int k = 7; k >= 0; k--) {
+                dst[i * 8 + k] |= (unsigned long long)_mm_movemask_epi8(v)
+                                  << (h * 16);
+                v = _mm_add_epi8(v, v);
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static inline void transpose64_avx2(
+    const unsigned long long src[64], unsigned long long dst[64]) {
+    memset(dst, 0, 64 * sizeof(dst[0]));
+    foreach_to(h, 2) {
+        __m128i a[4], b[4], c[4], d[4];
+        transpose_8x8_bytes_sse2(src + h * 32, a);
+        transpose_8x8_bytes_sse2(src + h * 32 + 8, b);
+        transpose_8x8_bytes_sse2(src + h * 32 + 16, c);
+        transpose_8x8_bytes_sse2(src + h * 32 + 24, d);
+        foreach_to(i, 8) {
+            /* byte i of the rows 32 h to 32 h + 31 */
+            __m128i lo = i % 2 ? _mm_unpackhi_epi64(a[i / 2], b[i / 2])
+                               : _mm_unpacklo_epi64(a[i / 2], b[i / 2]);
+            __m128i hi = i % 2 ? _mm_unpackhi_epi64(c[i / 2], d[i / 2])
+                               : _mm_unpacklo_epi64(c[i / 2], d[i / 2]);
+            __m256i v  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo),
+                                                 hi, 1);
+            for (int k = 7; k >= 0; k--) {
+                dst[i * 8 + k] |=
+                    (unsigned long long)(unsigned)_mm256_movemask_epi8(v)
+                    << (h * 32);
+                v = _mm256_add_epi8(v, v);
+            }
+        }
+    }
+}
+#endif
+
+/**
+ * ## Convolution
+ *
+ * The binary convolutions process activations in NHWC layout packed along the
+ * channels: the `channels` bits of a pixel are stored in
+ * `WORDS_LEN(x, channels)` words and the pixels of an image follow each other
+ * row by row. Pixel `(i, j)` of an image of width `width` thus starts at word
+ * `(i * width + j) * WORDS_LEN(x, channels)`. The filters are packed the same
+ * way: filter `o` is an image of `kernel_h x kernel_w` pixels starting at word
+ * `o * kernel_h * kernel_w * WORDS_LEN(w, channels)`.
+ *
+ * A `struct conv2d` describes the shape of a layer. The fields are set with
+ * designated initializers, omitted fields default to zero:
+ *
+ * ```
+ * struct conv2d conv = {.height = 32, .width = 32, .channels = 128,
+ *                       .filters = 256, .kernel_h = 3, .kernel_w = 3,
+ *                       .padding = 1};
+ * ```
+ *
+ * A grouped convolution splits the channels and the filters into `groups`
+ * groups: the filters of group `g` only see the `channels / groups` channels
+ * of group `g`, which are stored contiguously in the input pixels. A filter
+ * pixel holds the channels of its group in
+ * `WORDS_LEN(w, channels / groups)` words. Both `channels` and `filters` must
+ * be multiples of `groups`. Only `conv2d()` and `conv2d_scaled()` support
+ * groups.
+ *
+ * The bits of a packed image are +-1 values, so a zero padding cannot be
+ * stored as bits. Instead, the taps of a filter outside of the input image are
+ * left out of the sum and contribute zero, like the zeros of the trained model.
+ *
+ * With a `stride > 1`, only every `stride`-th output pixel of each row and
+ * column is computed. With a `dilation > 1`, the taps of a filter are
+ * `dilation` pixels apart in the input image; the filters are stored without
+ * gaps. The outputs in between are never evaluated.
+ */
+struct conv2d {
+    size_t height, width;      /* size of the input image */
+    size_t channels;           /* input channels, 64 per word */
+    size_t filters;            /* output channels */
+    size_t kernel_h, kernel_w; /* size of the filters */
+    size_t padding;            /* zero pixels around the input image */
+    size_t groups;             /* channel groups, divide channels and filters;
+                                  0 and 1 are ungrouped */
+    size_t stride;             /* distance of the outputs, 0 is 1 */
+    size_t dilation;           /* distance of the filter taps, 0 is 1 */
+};
+
+/* The stride and the dilation of `conv`, the default 0 is 1 */
+static inline size_t conv2d_stride(const struct conv2d* conv) {
+    return conv->stride ? conv->stride : 1;
+}
+
+static inline size_t conv2d_dilation(const struct conv2d* conv) {
+    return conv->dilation ? conv->dilation : 1;
+}
+
+/**
+ * ### conv2d_output_height() - Returns the number of output rows of `conv`
+ */
+static inline size_t conv2d_output_height(const struct conv2d* conv) {
+    size_t extent = conv2d_dilation(conv) * (conv->kernel_h - 1) + 1;
+    return (conv->height + 2 * conv->padding - extent) / conv2d_stride(conv) +
+           1;
+}
+
+/**
+ * ### conv2d_output_width() - Returns the number of output columns of `conv`
+ */
+static inline size_t conv2d_output_width(const struct conv2d* conv) {
+    size_t extent = conv2d_dilation(conv) * (conv->kernel_w - 1) + 1;
+    return (conv->width + 2 * conv->padding - extent) / conv2d_stride(conv) +
+           1;
+}
+
+/*
+ * The taps `[k0, k1)` of a filter of `k` taps, `dilation` pixels apart, that
+ * are inside of the input of `n` pixels. Tap `t` reads the padded input pixel
+ * `pos + t * dilation`, where `pos` is the output position times the stride.
+ * Only the outputs at the border leave out any taps.
+ */
+static inline void conv2d_clip(size_t pos, size_t padding, size_t k,
+                               size_t dilation, size_t n, size_t* k0,
+                               size_t* k1) {
+    *k0 = padding > pos ? (padding - pos + dilation - 1) / dilation : 0;
+    *k1 = n + padding > pos ? (n + padding - pos + dilation - 1) / dilation : 0;
+    if (*k1 > k) *k1 = k;
+    if (*k1 < *k0) *k1 = *k0;
+}
+
+/* Returns the `n <= 64` bits at bit `offset` of `x`, higher bits undefined */
+static inline unsigned long long bits_get(const unsigned long long x[],
+                                          size_t offset, size_t n) {
+    const size_t bits = NBITS(x[0]), shift = offset % bits;
+    unsigned long long v = x[offset / bits] >> shift;
+    if (shift && shift + n > bits) v |= x[offset / bits + 1] << (bits - shift);
+    return v;
+}
+
+/* The differing bits of the `n` bits at bit `offset` of `x` and of `w` */
+static inline __attribute__((always_inline)) size_t popcount_xor_bits(
+    const unsigned long long x[], size_t offset, const unsigned long long w[],
+    size_t n) {
+    const size_t bits = NBITS(w[0]);
+    size_t count      = 0;
+    for (size_t i = 0; i * bits < n; i++) {
+        size_t len = n - i * bits < bits ? n - i * bits : bits;
+        unsigned long long v = bits_get(x, offset + i * bits, len);
+        count += popcountll_kernel((v ^ w[i]) & tail_mask(len));
+    }
+    return count;
+}
+
+/*
+ * The grouped convolution. The channels of a group are a word aligned row of
+ * words if they fill whole words, otherwise they are extracted with shifts
+ * and the bits of the other groups are masked out.
+ */
+static inline __attribute__((always_inline)) void conv2d_grouped_kernel(
+    popcount_xor_fn popcount_xor, scale_q_fn scale_q, const struct conv2d* conv,
+    const unsigned long long x[], const unsigned long long w[],
+    const int32_t scale[], int shift, int y[]) {
+    assert(conv->channels % conv->groups == 0 &&
+           conv->filters % conv->groups == 0 &&
+           "the groups must divide the channels and the filters");
+    const size_t pixel = WORDS_LEN(x, conv->channels);
+    const size_t cg = conv->channels / conv->groups;
+    const size_t fg = conv->filters / conv->groups;
+    const size_t fpixel = WORDS_LEN(w, cg);
+    const size_t kh = conv->kernel_h, kw = conv->kernel_w;
+    const size_t ow = conv2d_output_width(conv), pad = conv->padding;
+    const size_t s = conv2d_stride(conv), d = conv2d_dilation(conv);
+    const int aligned = cg % NBITS(x[0]) == 0;
+    foreach_to(oy, conv2d_output_height(conv)) {
+        size_t ky0, ky1;
+        conv2d_clip(oy * s, pad, kh, d, conv->height, &ky0, &ky1);
+        foreach_to(ox, ow) {
+            size_t kx0, kx1;
+            conv2d_clip(ox * s, pad, kw, d, conv->width, &kx0, &kx1);
+            const int n = (int)((ky1 - ky0) * (kx1 - kx0) * cg);
+            int* out    = y + (oy * ow + ox) * conv->filters;
+            foreach_to(o, conv->filters) {
+                const size_t offset = o / fg * cg;
+                size_t count        = 0;
+                for (size_t ky = ky0; ky < ky1; ky++) {
+                    for (size_t kx = kx0; kx < kx1; kx++) {
+                        size_t i = (oy * s + ky * d - pad) * conv->width +
+                                   ox * s + kx * d;
+                        const unsigned long long* a = x + (i - pad) * pixel;
+                        const unsigned long long* b =
+                            w + ((o * kh + ky) * kw + kx) * fpixel;
+                        if (aligned) {
+                            a += offset / NBITS(x[0]);
+                            count += popcount_xor(fpixel, b, a);
+                        } else {
+                            count += popcount_xor_bits(a, offset, b, cg);
+                        }
+                    }
+                }
+                out[o] = n - 2 * (int)count;
+            }
+            if (scale) scale_q(conv->filters, scale, shift, out);
+        }
+    }
+}
+
+/*
+ * The direct convolution. If the channels fill whole words and the filter is
+ * not dilated, the pixels of a filter row and of the input below it are both
+ * contiguous, so each filter row is a single `popcount_xor()`. Otherwise the
+ * pixels are counted one by one and the padding bits of every pixel are
+ * masked out. A stride only moves the input window of an output. The taps
+ * inside of the image are determined once per output pixel; the loop over the
+ * filters is the same for the border and the interior. The outputs of a pixel
+ * are scaled by `scale_q()` while they are in the L1 cache, if `scale` is
+ * given.
+ */
+static inline __attribute__((always_inline)) void conv2d_kernel(
+    popcount_xor_fn popcount_xor, scale_q_fn scale_q, const struct conv2d* conv,
+    const unsigned long long x[], const unsigned long long w[],
+    const int32_t scale[], int shift, int y[]) {
+    const size_t pixel = WORDS_LEN(x, conv->channels);
+    const size_t kh = conv->kernel_h, kw = conv->kernel_w;
+    const size_t oh = conv2d_output_height(conv);
+    const size_t ow = conv2d_output_width(conv);
+    const size_t pad = conv->padding;
+    const size_t s = conv2d_stride(conv), d = conv2d_dilation(conv);
+    const int packed = conv->channels % NBITS(x[0]) == 0 && d == 1;
+    if (conv->groups > 1) {
+        conv2d_grouped_kernel(popcount_xor, scale_q, conv, x, w, scale, shift,
+                              y);
+        return;
+    }
+    foreach_to(oy, oh) {
+        size_t ky0, ky1;
+        conv2d_clip(oy * s, pad, kh, d, conv->height, &ky0, &ky1);
+        foreach_to(ox, ow) {
+            size_t kx0, kx1;
+            conv2d_clip(ox * s, pad, kw, d, conv->width, &kx0, &kx1);
+            const int n = (int)((ky1 - ky0) * (kx1 - kx0) * conv->channels);
+            const unsigned long long* in =
+                x + ((oy * s + ky0 * d - pad) * conv->width + ox * s +
+                     kx0 * d - pad) *
+                        pixel;
+            int* out = y + (oy * ow + ox) * conv->filters;
+            foreach_to(o, conv->filters) {
+                const unsigned long long* f =
+                    w + ((o * kh + ky0) * kw + kx0) * pixel;
+                size_t count = 0;
+                foreach_to(ky, ky1 - ky0) {
+                    const unsigned long long* a =
+                        in + ky * d * conv->width * pixel;
+                    const unsigned long long* b = f + ky * kw * pixel;
+                    if (packed) {
+                        count += popcount_xor((kx1 - kx0) * pixel, b, a);
+                        continue;
+                    }
+                    foreach_to(kx, kx1 - kx0) {
+                        count += popcount_xor_n_kernel(popcount_xor,
+                                                       conv->channels,
+                                                       b + kx * pixel,
+                                                       a + kx * d * pixel);
+                    }
+                }
+                out[o] = n - 2 * (int)count;
+            }
+            if (scale) scale_q(conv->filters, scale, shift, out);
+        }
+    }
+}
+
+static inline void conv2d_generic(const struct conv2d* conv,
+                                  const unsigned long long x[],
+                                  const unsigned long long w[],
+                                  const int32_t scale[], int shift, int y[]) {
+    conv2d_kernel(popcount_xor_generic, scale_q_generic, conv, x, w, scale,
+                  shift, y);
+}
+
+#ifdef GEISTEN_X86_64
+__attribute__((target("popcnt"))) static inline void conv2d_popcnt(
+    const struct conv2d* conv, const unsigned long long x[],
+    const unsigned long long w[], const int32_t scale[], int shift, int y[]) {
+    conv2d_kernel(popcount_xor_popcnt, scale_q_generic, conv, x, w, scale,
+                  shift, y);
+}
+
+__attribute__((target("avx2,popcnt"))) static inline void conv2d_avx2(
+    const struct conv2d* conv, const unsigned long long x[],
+    const unsigned long long w[], const int32_t scale[], int shift, int y[]) {
+    /* the filter rows of few channels are faster with the inlined popcnt */
+    size_t row = WORDS_LEN(x, conv->channels);
+    if (conv2d_dilation(conv) == 1) row *= conv->kernel_w;
+    if (row < POPCOUNT_XOR_AVX2_MIN_WORDS) {
+        conv2d_kernel(popcount_xor_popcnt, scale_q_avx2, conv, x, w, scale,
+                      shift, y);
+    } else {
+        conv2d_kernel(popcount_xor_avx2, scale_q_avx2, conv, x, w, scale,
+                      shift, y);
+    }
+}
+#endif
+
+/*
+ * The newest output column of a streaming 1D convolution. The last `taps`
+ * frames of `WORDS_LEN(x, channels)` words each are consecutive in `x`; they
+ * meet the last `taps` frames of every filter of `kernel` frames. If the
+ * channels fill whole words, a column is a single `popcount_xor()` per filter.
+ */
+static inline __attribute__((always_inline)) void conv1d_kernel(
+    popcount_xor_fn popcount_xor, size_t channels, size_t filters,
+    size_t kernel, size_t taps, const unsigned long long x[],
+    const unsigned long long w[], int y[]) {
+    const size_t pixel = WORDS_LEN(x, channels);
+    const int n        = (int)(taps * channels);
+    foreach_to(o, filters) {
+        const unsigned long long* f = w + (o * kernel + kernel - taps) * pixel;
+        size_t count                = 0;
+        if (channels % NBITS(x[0]) == 0) {
+            count = popcount_xor(taps * pixel, f, x);
+        } else {
+            foreach_to(t, taps) {
+                count += popcount_xor_n_kernel(popcount_xor, channels,
+                                               f + t * pixel, x + t * pixel);
+            }
+        }
+        y[o] = n - 2 * (int)count;
+    }
+}
+
+static inline void conv1d_generic(size_t channels, size_t filters,
+                                  size_t kernel, size_t taps,
+                                  const unsigned long long x[],
+                                  const unsigned long long w[], int y[]) {
+    conv1d_kernel(popcount_xor_generic, channels, filters, kernel, taps, x, w,
+                  y);
+}
+
+#ifdef GEISTEN_X86_64
+__attribute__((target("popcnt"))) static inline void conv1d_popcnt(
+    size_t channels, size_t filters, size_t kernel, size_t taps,
+    const unsigned long long x[], const unsigned long long w[], int y[]) {
+    conv1d_kernel(popcount_xor_popcnt, channels, filters, kernel, taps, x, w,
+                  y);
+}
+
+__attribute__((target("avx2,popcnt"))) static inline void conv1d_avx2(
+    size_t channels, size_t filters, size_t kernel, size_t taps,
+    const unsigned long long x[], const unsigned long long w[], int y[]) {
+    if (taps * WORDS_LEN(x, channels) < POPCOUNT_XOR_AVX2_MIN_WORDS) {
+        conv1d_kernel(popcount_xor_popcnt, channels, filters, kernel, taps, x,
+                      w, y);
+    } else {
+        conv1d_kernel(popcount_xor_avx2, channels, filters, kernel, taps, x, w,
+                      y);
+    }
+}
+#endif
+
+/*
+ * The im2col path gathers the receptive field of an output pixel into one
+ * row of `kernel_h * kernel_w * channels` bits without padding between the
+ * pixels. The bits of a pixel are appended word by word with shifts. The rows
+ * are kept on the stack (32 KiB by default) rather than in static memory, so
+ * the layers stay reentrant; define a smaller `CONV2D_IM2COL_WORDS` before
+ * including the header for small stacks.
+ */
+#ifndef CONV2D_IM2COL_WORDS
+#define CONV2D_IM2COL_WORDS 4096 /* words of the gathered rows on the stack */
+#endif
+
+/* Appends the `n` bits of `src` at bit `offset` of the cleared row `dst` */
+static inline void bits_append(unsigned long long dst[], size_t offset,
+                               const unsigned long long src[], size_t n) {
+    const size_t bits = NBITS(dst[0]);
+    for (size_t i = 0; i * bits < n; i++) {
+        size_t len = n - i * bits < bits ? n - i * bits : bits;
+        size_t pos = offset + i * bits, shift = pos % bits;
+        unsigned long long v = src[i] & tail_mask(len);
+        dst[pos / bits] |= v << shift;
+        if (shift + len > bits) dst[pos / bits + 1] |= v >> (bits - shift);
+    }
+}
+
+/* Returns the number of set bits of the `n` bits at bit `offset` of `w` */
+static inline size_t popcount_range(const unsigned long long w[],
+                                    size_t offset, size_t n) {
+    const size_t bits = NBITS(w[0]);
+    size_t count      = 0;
+    while (n) {
+        size_t shift = offset % bits, len = n < bits - shift ? n : bits - shift;
+        count += popcountll((w[offset / bits] >> shift) & tail_mask(len));
+        offset += len;
+        n -= len;
+    }
+    return count;
+}
+
+/*
+ * Gathers the receptive field of output pixel (oy, ox) into `row`. The taps
+ * outside of the image are left 0.
+ */
+static inline void conv2d_im2col_row(const struct conv2d* conv,
+                                     const unsigned long long x[], size_t oy,
+                                     size_t ox, unsigned long long row[]) {
+    const size_t pixel = WORDS_LEN(x, conv->channels);
+    const size_t k     = conv->kernel_h * conv->kernel_w * conv->channels;
+    const size_t s = conv2d_stride(conv), d = conv2d_dilation(conv);
+    size_t ky0, ky1, kx0, kx1;
+    conv2d_clip(oy * s, conv->padding, conv->kernel_h, d, conv->height, &ky0,
+                &ky1);
+    conv2d_clip(ox * s, conv->padding, conv->kernel_w, d, conv->width, &kx0,
+                &kx1);
+    memset(row, 0, WORDS_LEN(row, k) * sizeof(row[0]));
+    for (size_t ky = ky0; ky < ky1; ky++) {
+        for (size_t kx = kx0; kx < kx1; kx++) {
+            size_t i = (oy * s + ky * d - conv->padding) * conv->width +
+                       ox * s + kx * d - conv->padding;
+            bits_append(row, (ky * conv->kernel_w + kx) * conv->channels,
+                        x + i * pixel, conv->channels);
+        }
+    }
+}
+
+/*
+ * A tap outside of the image is gathered as 0 bits and adds
+ * `channels - 2 popcount(w)` of the filter pixel `w` to the XNOR-GEMM. The
+ * correction subtracts these sums from the outputs at the border.
+ */
+static inline void conv2d_im2col_correct(const struct conv2d* conv,
+                                         const unsigned long long packed[],
+                                         size_t oy, size_t ox, int y[]) {
+    const size_t k      = conv->kernel_h * conv->kernel_w * conv->channels;
+    const size_t stride = WORDS_LEN(packed, k);
+    const size_t s = conv2d_stride(conv), d = conv2d_dilation(conv);
+    size_t ky0, ky1, kx0, kx1;
+    conv2d_clip(oy * s, conv->padding, conv->kernel_h, d, conv->height, &ky0,
+                &ky1);
+    conv2d_clip(ox * s, conv->padding, conv->kernel_w, d, conv->width, &kx0,
+                &kx1);
+    foreach_to(ky, conv->kernel_h) {
+        foreach_to(kx, conv->kernel_w) {
+            if (ky >= ky0 && ky < ky1 && kx >= kx0 && kx < kx1) continue;
+            size_t offset = (ky * conv->kernel_w + kx) * conv->channels;
+            foreach_to(o, conv->filters) {
+                size_t count = popcount_range(packed + o * stride, offset,
+                                              conv->channels);
+                y[o] -= (int)conv->channels - 2 * (int)count;
+            }
+        }
+    }
+}
+
+/*
+ * The direct convolution with the packed filters, for receptive fields that
+ * do not fit into the rows on the stack. Each tap is compared with its bits
+ * of the packed filter, the taps outside of the image are left out.
+ */
+static inline void conv2d_im2col_unblocked(const struct conv2d* conv,
+                                           const unsigned long long x[],
+                                           const unsigned long long packed[],
+                                           int y[]) {
+    const size_t pixel  = WORDS_LEN(x, conv->channels);
+    const size_t k      = conv->kernel_h * conv->kernel_w * conv->channels;
+    const size_t stride = WORDS_LEN(packed, k);
+    const size_t ow     = conv2d_output_width(conv), pad = conv->padding;
+    const size_t s = conv2d_stride(conv), d = conv2d_dilation(conv);
+    foreach_to(oy, conv2d_output_height(conv)) {
+        size_t ky0, ky1;
+        conv2d_clip(oy * s, pad, conv->kernel_h, d, conv->height, &ky0, &ky1);
+        foreach_to(ox, ow) {
+            size_t kx0, kx1;
+            conv2d_clip(ox * s, pad, conv->kernel_w, d, conv->width, &kx0,
+                        &kx1);
+            const int n = (int)((ky1 - ky0) * (kx1 - kx0) * conv->channels);
+            int* out    = y + (oy * ow + ox) * conv->filters;
+            foreach_to(o, conv->filters) {
+                size_t count = 0;
+                for (size_t ky = ky0; ky < ky1; ky++) {
+                    for (size_t kx = kx0; kx < kx1; kx++) {
+                        size_t i = (oy * s + ky * d - pad) * conv->width +
+                                   ox * s + kx * d - pad;
+                        count += popcount_xor_bits(
+                            packed + o * stride,
+                            (ky * conv->kernel_w + kx) * conv->channels,
+                            x + i * pixel, conv->channels);
+                    }
+                }
+                out[o] = n - 2 * (int)count;
+            }
+        }
+    }
+}
+
+/**
+ * ### pool2d_output_size() - Returns the output size of a pooling of `n` pixels
+ * - `n` The height or width of the input image
+ * - `size` The height and width of the pooling window
+ * - `stride` The distance of the windows
+ */
+static inline size_t pool2d_output_size(size_t n, size_t size, size_t stride) {
+    return (n - size) / stride + 1;
+}
+
+/*
+ * Pooling of binary activations: the maximum of +-1 values is the OR of their
+ * bits and the minimum the AND. The AND is computed as OR of the inverted
+ * bits (`invert = ~0`), so both share one loop over the channel words.
+ */
+#define POOL2D_KERNEL(_words, _height, _width, _channels, _size, _stride,  \
+                      _invert, _x, _y)                                     \
+    do {                                                                   \
+        const size_t pixel_ = WORDS_LEN((_x), (_channels));                \
+        const size_t row_   = (_width) * pixel_;                           \
+        const size_t oh_    = pool2d_output_size(_height, _size, _stride); \
+        const size_t ow_    = pool2d_output_size(_width, _size, _stride);  \
+        foreach_to(oy_, oh_) {                                             \
+            foreach_to(ox_, ow_) {                                         \
+                size_t i_ = (oy_ * row_ + ox_ * pixel_) * (_stride);       \
+                _words(pixel_, (_size), row_, (_x) + i_, (_invert),        \
+                       (_y) + (oy_ * ow_ + ox_) * pixel_);                 \
+            }                                                              \
+        }                                                                  \
+    } while (0)
+
+/* The OR of word `x[0]` of the `size x size` pixels of `pixel` words */
+static inline unsigned long long pool2d_word(size_t pixel, size_t size,
+                                             size_t row,
+                                             const unsigned long long x[],
+                                             unsigned long long invert) {
+    unsigned long long acc = 0;
+    foreach_to(ky, size) {
+        foreach_to(kx, size) { acc |= x[ky * row + kx * pixel] ^ invert; }
+    }
+    return acc ^ invert;
+}
+
+static inline void pool2d_words_generic(size_t pixel, size_t size, size_t row,
+                                        const unsigned long long x[],
+                                        unsigned long long invert,
+                                        unsigned long long y[]) {
+    foreach_to(i, pixel) {
+        y[i] = pool2d_word(pixel, size, row, x + i, invert);
+    }
+}
+
+static inline void pool2d_generic(size_t height, size_t width, size_t channels,
+                                  size_t size, size_t stride,
+                                  unsigned long long invert,
+                                  const unsigned long long x[],
+                                  unsigned long long y[]) {
+    POOL2D_KERNEL(pool2d_words_generic, height, width, channels, size, stride,
+                  invert, x, y);
+}
+
+#ifdef GEISTEN_X86_64
+__attribute__((target("avx2"))) static inline void pool2d_words_avx2(
+    size_t pixel, size_t size, size_t row, const unsigned long long x[],
+    unsigned long long invert, unsigned long long y[]) {
+    const __m256i inv = _mm256_set1_epi64x((long long)invert);
+    size_t i          = 0;
+    for (; i + 4 <= pixel; i += 4) {
+        __m256i acc = _mm256_setzero_si256();
+        foreach_to(ky, size) {
+            foreach_to(kx, size) {
+                __m256i v = _mm256_loadu_si256(
+                    (const __m256i*)(x + ky * row + kx * pixel + i));
+                acc = _mm256_or_si256(acc, _mm256_xor_si256(v, inv));
+            }
+        }
+        _mm256_storeu_si256((__m256i*)(y + i), _mm256_xor_si256(acc, inv));
+    }
+    for (; i < pixel; i++) {
+        y[i] = pool2d_word(pixel, size, row, x + i, invert);
+    }
+}
+
+__attribute__((target("avx2"))) static inline void pool2d_avx2(
+    size_t height, size_t width, size_t channels, size_t size, size_t stride,
+    unsigned long long invert, const unsigned long long x[],
+    unsigned long long y[]) {
+    POOL2D_KERNEL(pool2d_words_avx2, height, width, channels, size, stride,
+                  invert, x, y);
+}
+#endif
+
+/**
+ * ## Kernel dispatch
+ *
+ * The kernels are compiled for several instruction set extensions into the
+ * same binary. `geisten_init()` selects the best variant supported by the
+ * running CPU. The environment variable `GEISTEN_ISA` forces a variant
+ * (`avx2`, `popcnt` or `generic`) for A/B benchmarks; an unknown or
+ * unsupported variant is ignored.
+ *
+ * `popcount_xor()`, `linear_n()` and the layer functions below call the
+ * selected variant. They run `geisten_init()` on their first call, so calling
+ * it is optional. Since the library is header only, every translation unit
+ * has its own selection.
+ */
+struct geisten_kernels {
+    const char* name;
+    unsigned cpu_features; /* required GEISTEN_CPU_* flags */
+    popcount_xor_fn popcount_xor;
+    void (*dense)(size_t n, size_t m, const unsigned long long w[],
+                  const unsigned long long x[], int y[]);
+    void (*dense_binarize)(size_t n, size_t m, const unsigned long long w[],
+                           const unsigned long long x[],
+                           const int threshold[], const int8_t sign[],
+                           unsigned long long result[]);
+    void (*bitplanes)(size_t n, const uint8_t x[], unsigned long long planes[]);
+    void (*dense_bitplanes)(size_t n, size_t m, const unsigned long long w[],
+                            const unsigned long long planes[], int msb,
+                            int y[]);
+    void (*transpose64)(const unsigned long long src[64],
+                        unsigned long long dst[64]);
+    scale_q_fn scale_q;
+    void (*dense_i8)(size_t n, size_t m, const int8_t w[], const int8_t x[],
+                     const int32_t bias[], int32_t y[]);
+    void (*residual)(size_t pixels, size_t channels, const int y[],
+                     int16_t shortcut[], const int16_t threshold[],
+                     unsigned long long result[]);
+    void (*conv2d)(const struct conv2d* conv, const unsigned long long x[],
+                   const unsigned long long w[], const int32_t scale[],
+                   int shift, int y[]);
+    void (*conv1d)(size_t channels, size_t filters, size_t kernel, size_t taps,
+                   const unsigned long long x[], const unsigned long long w[],
+                   int y[]);
+    void (*pool2d)(size_t height, size_t width, size_t channels, size_t size,
+                   size_t stride, unsigned long long invert,
+                   const unsigned long long x[], unsigned long long y[]);
+    void (*gemm_xnor)(size_t k, size_t m, size_t n,
+                      const unsigned long long a[],
+                      const unsigned long long b[], int c[], size_t cs_i,
+                      size_t cs_j);
+#define BINARIZE_MEMBERS(_suffix, _type)                           \
+    void (*binarize_##_suffix)(size_t n, const _type x[],          \
+                               const _type threshold[],            \
+                               unsigned long long result[]);       \
+    void (*binarize_##_suffix##_scalar)(size_t n, const _type x[], \
+                                        _type threshold,           \
+                                        unsigned long long result[]);
+    BINARIZE_MEMBERS(f32, float)
+    BINARIZE_MEMBERS(i16, int16_t)
+    BINARIZE_MEMBERS(u16, uint16_t)
+    BINARIZE_MEMBERS(i8, int8_t)
+    BINARIZE_MEMBERS(u8, uint8_t)
+#undef BINARIZE_MEMBERS
+};
+
+#define BINARIZE_KERNELS(_isa)                           \
+    .binarize_f32 = binarize_f32_##_isa,                 \
+    .binarize_f32_scalar = binarize_f32_##_isa##_scalar, \
+    .binarize_i16 = binarize_i16_##_isa,                 \
+    .binarize_i16_scalar = binarize_i16_##_isa##_scalar, \
+    .binarize_u16 = binarize_u16_##_isa,                 \
+    .binarize_u16_scalar = binarize_u16_##_isa##_scalar, \
+    .binarize_i8 = binarize_i8_##_isa,                   \
+    .binarize_i8_scalar = binarize_i8_##_isa##_scalar,   \
+    .binarize_u8 = binarize_u8_##_isa,                   \
+    .binarize_u8_scalar = binarize_u8_##_isa##_scalar
+
+/* The variants, best first */
+static const struct geisten_kernels geisten_kernels_table[] = {
+#ifdef GEISTEN_X86_64
+    {.name            = "avx2",
+     .cpu_features    = GEISTEN_CPU_AVX2 | GEISTEN_CPU_POPCNT,
+     .popcount_xor    = popcount_xor_avx2,
+     .dense           = dense_avx2,
+     .dense_binarize  = dense_binarize_avx2,
+     .bitplanes       = bitplanes_avx2,
+     .dense_bitplanes = dense_bitplanes_avx2,
+     .transpose64     = transpose64_avx2,
+     .gemm_xnor       = gemm_xnor_avx2,
+     .scale_q         = scale_q_avx2,
+     .residual        = residual_binarize_avx2,
+     .dense_i8        = dense_i8_avx2,
+     .conv2d          = conv2d_avx2,
+     .conv1d          = conv1d_avx2,
+     .pool2d          = pool2d_avx2,
+     BINARIZE_KERNELS(avx2)},
+    {.name            = "popcnt",
+     .cpu_features    = GEISTEN_CPU_POPCNT,
+     .popcount_xor    = popcount_xor_popcnt,
+     .dense           = dense_popcnt,
+     .dense_binarize  = dense_binarize_popcnt,
+     .bitplanes       = bitplanes_generic,
+     .dense_bitplanes = dense_bitplanes_popcnt,
+     .transpose64     = transpose64_sse2,
+     .gemm_xnor       = gemm_xnor_popcnt,
+     .scale_q         = scale_q_generic,
+     .residual        = residual_binarize_generic,
+     .dense_i8        = dense_i8_generic,
+     .conv2d          = conv2d_popcnt,
+     .conv1d          = conv1d_popcnt,
+     .pool2d          = pool2d_generic,
+     BINARIZE_KERNELS(generic)},
+#endif
+    {.name            = "generic",
+     .cpu_features    = 0,
+     .popcount_xor    = popcount_xor_generic,
+     .dense           = dense_generic,
+     .dense_binarize  = dense_binarize_generic,
+     .bitplanes       = bitplanes_generic,
+     .dense_bitplanes = dense_bitplanes_generic,
+     .transpose64     = transpose64_generic,
+     .gemm_xnor       = gemm_xnor_generic,
+     .scale_q         = scale_q_generic,
+     .residual        = residual_binarize_generic,
+     .dense_i8        = dense_i8_generic,
+     .conv2d          = conv2d_generic,
+     .conv1d          = conv1d_generic,
+     .pool2d          = pool2d_generic,
+     BINARIZE_KERNELS(generic)},
+};
+
+#undef BINARIZE_KERNELS
+
+static const struct geisten_kernels* geisten_kernels_active;
+
+/**
+ * ### geisten_select() - Selects the kernel variant `name`.
+ * - `name` The variant name, e.g. `avx2`, or `NULL` for the best variant
+ *
+ * Return the selected kernels or `NULL` if `name` is unknown or not supported
+ * by the running CPU. The active selection is unchanged in the latter case.
+ */
+static inline const struct geisten_kernels* geisten_select(const char* name) {
+    foreach (i, geisten_kernels_table) {
+        const struct geisten_kernels* k = &geisten_kernels_table[i];
+        if ((geisten_cpu_features() & k->cpu_features) != k->cpu_features) {
+            continue;
+        }
+        if (name == NULL || strcmp(name, k->name) == 0) {
+            __atomic_store_n(&geisten_kernels_active, k, __ATOMIC_RELEASE);
+            return k;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * ### geisten_init() - Selects the kernels for the running CPU.
+ *
+ * Return the selected kernels. The variant named by the environment variable
+ * `GEISTEN_ISA` takes precedence over the best supported variant.
+ */
+static inline const struct geisten_kernels* geisten_init(void) {
+    const struct geisten_kernels* k = geisten_select(getenv("GEISTEN_ISA"));
+    return k ? k : geisten_select(NULL);
+}
+
+/*
+ * Selects the next supported variant after `prev` (`NULL` for the first) and
+ * returns its name, or `NULL` after the last one.
+ */
+static inline const char* geisten_kernels_next(const char* prev) {
+    size_t i = 0;
+    if (prev) {
+        while (geisten_kernels_table[i].name != prev) i++;
+        i++;
+    }
+    for (; i < sizeof(geisten_kernels_table) / sizeof(geisten_kernels_table[0]);
+         i++) {
+        if (geisten_select(geisten_kernels_table[i].name)) {
+            return geisten_kernels_table[i].name;
+        }
+    }
+    return NULL;
+}
+
+/* Restores the default selection when a `foreach_kernels()` loop is left */
+static inline void geisten_kernels_restore(const char** name) {
+    (void)name;
+    geisten_init();
+}
+
+/**
+ * ### foreach_kernels() - Runs the loop body with every supported variant
+ * - `_name` The name of the selected variant, e.g. `avx2`
+ *
+ * Selects each variant in turn, e.g. to compare or to benchmark them. When
+ * the loop is left, also by `break` or `return`, `geisten_init()` restores
+ * the default selection.
+ */
+#define foreach_kernels(_name)                               \
+    for (const char* _name                                   \
+         __attribute__((cleanup(geisten_kernels_restore))) = \
+             geisten_kernels_next(NULL);                     \
+         _name; _name = geisten_kernels_next(_name))
+
+/**
+ * ### geisten_dispatch() - Returns the active kernels.
+ */
+static inline const struct geisten_kernels* geisten_dispatch(void) {
+    const struct geisten_kernels* k =
+        __atomic_load_n(&geisten_kernels_active, __ATOMIC_ACQUIRE);
+    return k ? k : geisten_init();
+}
+
+/**
+ * ### popcount_xor() - Returns the number of differing bits of the word arrays `a` and `b`.
+ * - `words` The number of words of both arrays
+ * - `a` The first word array
+ * - `b` The second word array
+ */
+static inline size_t popcount_xor(size_t words, const unsigned long long a[],
+                                  const unsigned long long b[]) {
+    return geisten_dispatch()->popcount_xor(words, a, b);
+}
+
+/**
+ * ### linear_n() - Linear transformation of the bit rows `w` and `x` with `n` elements
+ * - `n` The number of valid bits of both rows
+ * - `w` The binary weights row of `WORDS_LEN(w, n)` words
+ * - `x` The activation binaries row of `WORDS_LEN(x, n)` words
+ *
+ * Computes the same sum as `linear()` over all words of a row. The padding bits
+ * of the last word (positions `>= n`) are masked out and do not contribute to
+ * the result, whatever their value.
+ *
  * Return the sum of the element wise multiplication.
  */
-#define linear(_w, _x) (2 * popcount((_x) ^ (_w)) - NBITS((_x)))
+static inline int linear_n(size_t n, const unsigned long long w[],
+                           const unsigned long long x[]) {
+    return linear_n_kernel(geisten_dispatch()->popcount_xor, n, w, x);
+}
+
+/**
+ * ### dense() - Dense binary layer `y = w x`
+ * - `n` The number of inputs (valid bits of `x` and of each row of `w`)
+ * - `m` The number of outputs
+ * - `w` The binary weights matrix of `m` rows with `WORDS_LEN(w, n)` words each
+ * - `x` The activation binaries row
+ * - `y` The `m` outputs
+ *
+ * Computes `y[j] = linear_n(n, w[j], x)` for all outputs `j`.
+ */
+static inline void dense(size_t n, size_t m, const unsigned long long w[],
+                         const unsigned long long x[], int y[]) {
+    geisten_dispatch()->dense(n, m, w, x, y);
+}
+
+/**
+ * ### dense_binarize() - Dense binary layer with binary outputs `y = sign(w x)`
+ * - `n` The number of inputs (valid bits of `x` and of each row of `w`)
+ * - `m` The number of outputs
+ * - `w` The binary weights matrix of `m` rows with `WORDS_LEN(w, n)` words each
+ * - `x` The activation binaries row
+ * - `threshold` The `m` thresholds of the outputs
+ * - `sign` The `m` signs of the outputs
+ * - `result` The output bit array of `WORDS_LEN(result, m)` words
+ *
+ * Sets bit `j` of `result` to `batchnorm_bit(p, threshold[j], sign[j])`, where
+ * `p` is the number of differing bits of `w[j]` and `x`, e.g. with thresholds
+ * from `batchnorm_fold()`. With all signs `1`, the bit is set for
+ * `linear_n(n, w[j], x) >= n - 2 * threshold[j]`. The result is the input of
+ * the next layer: the bits are packed in registers, no `int` outputs are
+ * written and the padding bits of the last word are cleared.
+ */
+static inline void dense_binarize(size_t n, size_t m,
+                                  const unsigned long long w[],
+                                  const unsigned long long x[],
+                                  const int threshold[], const int8_t sign[],
+                                  unsigned long long result[]) {
+    geisten_dispatch()->dense_binarize(n, m, w, x, threshold, sign, result);
+}
+
+/**
+ * ### dense_scaled() - Dense binary layer with scale factors `y = alpha w x`
+ * - `n` The number of inputs (valid bits of `x` and of each row of `w`)
+ * - `m` The number of outputs
+ * - `w` The binary weights matrix of `m` rows with `WORDS_LEN(w, n)` words each
+ * - `x` The activation binaries row
+ * - `scale` The `m` scale factors with `shift` fractional bits, e.g. from
+ *   `scale_quantize()`
+ * - `shift` The number of fractional bits of `scale` (0 to 31)
+ * - `y` The `m` outputs
+ *
+ * Computes `y[j] = round(linear_n(n, w[j], x) * scale[j] / 2^shift)` for all
+ * outputs `j`, e.g. with the per output scale factors of XNOR-Net. The
+ * outputs are scaled in blocks of `DENSE_SCALED_BLOCK` right after their
+ * accumulation, eight outputs per instruction with AVX2. The result is
+ * truncated to `int`: `n * |scale[j]| / 2^shift` must fit.
+ */
+static inline void dense_scaled(size_t n, size_t m,
+                                const unsigned long long w[],
+                                const unsigned long long x[],
+                                const int32_t scale[], int shift, int y[]) {
+    const struct geisten_kernels* kernels = geisten_dispatch();
+    const size_t stride                   = WORDS_LEN(w, n);
+    for (size_t j = 0; j < m; j += DENSE_SCALED_BLOCK) {
+        size_t len = m - j < DENSE_SCALED_BLOCK ? m - j : DENSE_SCALED_BLOCK;
+        kernels->dense(n, len, w + j * stride, x, y + j);
+        kernels->scale_q(len, scale + j, shift, y + j);
+    }
+}
+
+/**
+ * ### gemm_xnor() - Binary matrix multiplication `c = a b^T`
+ * - `k` The number of valid bits of each row of `a` and `b`
+ * - `m` The number of rows of `a`
+ * - `n` The number of rows of `b`
+ * - `a` The `m` rows of `WORDS_LEN(a, k)` words each, e.g. the weights
+ * - `b` The `n` rows of `WORDS_LEN(b, k)` words each, e.g. the samples
+ * - `c` The `m x n` result matrix (row major)
+ *
+ * Computes `c[i * n + j] = linear_n(k, a[i], b[j])` for all rows of `a` and
+ * `b`, blocked over `k` (`GEMM_XNOR_KC` words) and the rows of `a`
+ * (`GEMM_XNOR_MC`) so the blocks stay in the L1 cache. The kernel depends on
+ * the variant:
+ *
+ * - generic, popcnt: tiles of a row of `a` and 4 rows of `b`, every loaded
+ *   word of `a` is used by four popcounts. The rows of `b` that do not fill a
+ *   tile are counted with the row kernel of `dense()`.
+ * - avx2: the pairs of rows are counted with the Harley-Seal row kernel,
+ *   which needs one popcount per 16 vectors. Rows shorter than
+ *   `GEMM_XNOR_AVX2_MIN_WORDS` use the tiles.
+ *
+ * With 4096 x 64 rows of 4096 bits on a Xeon, the popcnt tile reaches 321
+ * binary GOPS, the popcnt row kernel 253 and a 4 x 4 tile, which spills its
+ * 16 counters, 150. The AVX2 row kernel reaches 370 GOPS, but 187 for rows
+ * of 1024 bits, where the tile reaches 285.
+ */
+static inline void gemm_xnor(size_t k, size_t m, size_t n,
+                             const unsigned long long a[],
+                             const unsigned long long b[], int c[]) {
+    geisten_dispatch()->gemm_xnor(k, m, n, a, b, c, n, 1);
+}
+
+/**
+ * ### dense_batch() - Dense binary layer `y = w x` for a batch of inputs
+ * - `n` The number of inputs (valid bits of each row of `x` and `w`)
+ * - `m` The number of outputs
+ * - `batch` The number of samples
+ * - `w` The binary weights matrix of `m` rows with `WORDS_LEN(w, n)` words each
+ * - `x` The `batch` activation rows with `WORDS_LEN(x, n)` words each
+ * - `y` The `batch x m` outputs, `m` consecutive outputs per sample
+ *
+ * Computes `dense(n, m, w, x[s], y[s])` for all samples `s`, but iterates the
+ * weights only once per batch: a block of weight rows stays in the cache while
+ * all samples of the batch pass by, and every weight word is loaded once for
+ * 4 samples. A single sample is computed by `dense()`, the samples of a batch
+ * that do not fill a group of 4 by its row kernel, so a batch is never slower
+ * than the samples one by one. The gain is largest if the weights do not fit
+ * into the cache.
+ */
+static inline void dense_batch(size_t n, size_t m, size_t batch,
+                               const unsigned long long w[],
+                               const unsigned long long x[], int y[]) {
+    if (batch == 1) {
+        dense(n, m, w, x, y);
+    } else {
+        geisten_dispatch()->gemm_xnor(n, m, batch, w, x, y, 1, m);
+    }
+}
+
+/**
+ * ### bitplanes_u8() - Split the `n` elements of `x` into 8 bit-planes
+ * - `n` The length of the array `x`
+ * - `x` The 8 bit inputs, e.g. the pixels of an image
+ * - `planes` The bit array of `8 * WORDS_LEN(planes, n)` words
+ *
+ * Bit `k` of the elements `64 i` to `64 i + 63` is stored in
+ * `planes[8 * i + k]`, the padding bits of the last words are cleared. The
+ * planes keep the full precision of the inputs for `dense_bitplanes_u8()`.
+ */
+static inline void bitplanes_u8(size_t n, const uint8_t x[],
+                                unsigned long long planes[]) {
+    geisten_dispatch()->bitplanes(n, x, planes);
+}
+
+/**
+ * ### bitplanes_i8() - Split the `n` elements of `x` into 8 bit-planes
+ *
+ * The two's complement bits of `x`, see `bitplanes_u8()`.
+ */
+static inline void bitplanes_i8(size_t n, const int8_t x[],
+                                unsigned long long planes[]) {
+    geisten_dispatch()->bitplanes(n, (const uint8_t*)x, planes);
+}
+
+/**
+ * ### dense_bitplanes_u8() - Dense layer of 8 bit inputs and binary weights
+ * - `n` The number of inputs (valid bits of each row of `w`)
+ * - `m` The number of outputs
+ * - `w` The binary weights matrix of `m` rows with `WORDS_LEN(w, n)` words each
+ * - `planes` The bit-planes of the inputs from `bitplanes_u8()`
+ * - `y` The `m` outputs
+ *
+ * Computes `y[j] = sum(x[i] * (w[j][i] ? 1 : -1))` exactly, e.g. for the first
+ * layer of a vision model, with one `popcount(plane & w)` per plane and word.
+ * The result is the sum of the plane results shifted by their bit position.
+ */
+static inline void dense_bitplanes_u8(size_t n, size_t m,
+                                      const unsigned long long w[],
+                                      const unsigned long long planes[],
+                                      int y[]) {
+    geisten_dispatch()->dense_bitplanes(n, m, w, planes, 128, y);
+}
+
+/**
+ * ### dense_bitplanes_i8() - Dense layer of signed 8 bit inputs and binary weights
+ *
+ * Like `dense_bitplanes_u8()` for the planes of `bitplanes_i8()`: the plane
+ * of the sign bit has the weight `-128`.
+ */
+static inline void dense_bitplanes_i8(size_t n, size_t m,
+                                      const unsigned long long w[],
+                                      const unsigned long long planes[],
+                                      int y[]) {
+    geisten_dispatch()->dense_bitplanes(n, m, w, planes, -128, y);
+}
+
+/**
+ * ### transpose64() - Transpose the 64 x 64 bit matrix `src` into `dst`
+ * - `src` The 64 rows of one word each
+ * - `dst` The 64 transposed rows, bit `c` of row `r` of `src` is bit `r` of
+ *   row `c`
+ */
+static inline void transpose64(const unsigned long long src[64],
+                               unsigned long long dst[64]) {
+    geisten_dispatch()->transpose64(src, dst);
+}
+
+/**
+ * ### transpose_bits() - Transpose the `m x n` bit matrix `src` into `dst`
+ * - `m` The number of rows of `src`
+ * - `n` The number of valid bits of each row of `src`
+ * - `src` The `m` rows of `WORDS_LEN(src, n)` words each
+ * - `dst` The `n` rows of `WORDS_LEN(dst, m)` words each
+ *
+ * Converts between output-major and input-major packed layouts, e.g. of
+ * weights on import, in blocks of 64 x 64 bits. The padding bits of `src` are
+ * ignored, the padding bits of `dst` are cleared.
+ */
+static inline void transpose_bits(size_t m, size_t n,
+                                  const unsigned long long src[],
+                                  unsigned long long dst[]) {
+    const struct geisten_kernels* kernels = geisten_dispatch();
+    size_t src_words = WORDS_LEN(src, n), dst_words = WORDS_LEN(dst, m);
+    unsigned long long block[64], out[64];
+    foreach_to(bi, dst_words) {
+        size_t rows = m - bi * 64 < 64 ? m - bi * 64 : 64;
+        foreach_to(bj, src_words) {
+            size_t cols = n - bj * 64 < 64 ? n - bj * 64 : 64;
+            foreach_to(r, rows) {
+                block[r] = src[(bi * 64 + r) * src_words + bj];
+            }
+            memset(block + rows, 0, (64 - rows) * sizeof(block[0]));
+            kernels->transpose64(block, out);
+            foreach_to(c, cols) {
+                dst[(bj * 64 + c) * dst_words + bi] = out[c];
+            }
+        }
+    }
+}
+
+/**
+ * ### conv2d() - Binary 2D convolution of a channel packed image
+ * - `conv` The shape of the layer
+ * - `x` The input image of `height x width` pixels
+ * - `w` The `filters` filters of `kernel_h x kernel_w` pixels
+ * - `y` The output image of `conv2d_output_height(conv) x
+ *   conv2d_output_width(conv)` pixels of `filters` values each (NHWC)
+ *
+ * Computes for every output pixel and filter the sum of `linear_n()` of the
+ * filter pixels and the input pixels below, without a copy of the input. The
+ * filters leave the input image by `padding` pixels, where the taps outside
+ * contribute zero. With `groups > 1`, each filter only sees the channels of its
+ * group; groups of less than a word are masked out of the pixel words. With
+ * `stride` and `dilation`, only the output pixels of the strided grid are
+ * computed from the dilated taps, e.g. a layer of stride 2 costs a quarter of
+ * the same layer with stride 1.
+ */
+static inline void conv2d(const struct conv2d* conv,
+                          const unsigned long long x[],
+                          const unsigned long long w[], int y[]) {
+    geisten_dispatch()->conv2d(conv, x, w, NULL, 0, y);
+}
+
+/**
+ * ### conv2d_scaled() - Binary 2D convolution with scale factors per filter
+ * - `conv` The shape of the layer
+ * - `x` The input image of `height x width` pixels
+ * - `w` The `filters` filters of `kernel_h x kernel_w` pixels
+ * - `scale` The `filters` scale factors with `shift` fractional bits, e.g.
+ *   from `scale_quantize()`
+ * - `shift` The number of fractional bits of `scale` (0 to 31)
+ * - `y` The output image of `conv2d()`
+ *
+ * Like `conv2d()`, but every output of filter `o` is
+ * `round(sum * scale[o] / 2^shift)`. The outputs of a pixel are scaled as soon
+ * as all filters are accumulated, see `dense_scaled()`.
+ */
+static inline void conv2d_scaled(const struct conv2d* conv,
+                                 const unsigned long long x[],
+                                 const unsigned long long w[],
+                                 const int32_t scale[], int shift, int y[]) {
+    geisten_dispatch()->conv2d(conv, x, w, scale, shift, y);
+}
+
+/**
+ * ### conv2d_im2col_pack() - Pack the filters of `conv` for `conv2d_im2col()`
+ * - `conv` The shape of the layer
+ * - `w` The filters in the layout of `conv2d()`
+ * - `packed` The `filters` rows of `WORDS_LEN(packed, k)` words each, where
+ *   `k = kernel_h * kernel_w * channels`
+ *
+ * The pixels of a filter are concatenated without the padding bits of their
+ * last words. The filters are packed once when the model is loaded. Grouped
+ * layers are not supported.
+ */
+static inline void conv2d_im2col_pack(const struct conv2d* conv,
+                                      const unsigned long long w[],
+                                      unsigned long long packed[]) {
+    assert(conv->groups <= 1 && "grouped layers use conv2d()");
+    struct conv2d filter = *conv;
+    filter.height        = conv->kernel_h;
+    filter.width         = conv->kernel_w;
+    filter.padding       = 0;
+    filter.stride        = 1;
+    filter.dilation      = 1;
+    const size_t area    = conv->kernel_h * conv->kernel_w;
+    const size_t pixel   = WORDS_LEN(w, conv->channels);
+    const size_t stride  = WORDS_LEN(packed, area * conv->channels);
+    foreach_to(o, conv->filters) {
+        conv2d_im2col_row(&filter, w + o * area * pixel, 0, 0,
+                          packed + o * stride);
+    }
+}
+
+/**
+ * ### conv2d_im2col() - Binary 2D convolution with im2col and `gemm_xnor()`
+ * - `conv` The shape of the layer
+ * - `x` The input image of `height x width` pixels
+ * - `packed` The filters of `conv2d_im2col_pack()`
+ * - `y` The output image, see `conv2d()`
+ *
+ * Computes the same result as `conv2d()`. The receptive fields of a block of
+ * output pixels are gathered into bit rows of `CONV2D_IM2COL_WORDS` words on
+ * the stack, which are multiplied with the filters by the blocked XNOR-GEMM.
+ * Since the rows have no padding between the pixels, layers with few channels
+ * per word (`conv2d_prefer_im2col()`) run faster than with `conv2d()`. A
+ * receptive field that does not fit into the rows
+ * (`k > 64 * CONV2D_IM2COL_WORDS`) is convolved directly with the packed
+ * filters, which is much slower, see `conv2d_prefer_im2col()`. The rows take
+ * `CONV2D_IM2COL_WORDS` words of stack. With padding, the outputs at the
+ * border are corrected after the GEMM for the taps outside of the image; the
+ * interior is not touched.
+ * Grouped layers are not supported (checked by `assert()`), they use
+ * `conv2d()`; `conv2d_prefer_im2col()` returns 0 for them.
+ */
+static inline void conv2d_im2col(const struct conv2d* conv,
+                                 const unsigned long long x[],
+                                 const unsigned long long packed[], int y[]) {
+    assert(conv->groups <= 1 && "grouped layers use conv2d()");
+    unsigned long long rows[CONV2D_IM2COL_WORDS];
+    const size_t k      = conv->kernel_h * conv->kernel_w * conv->channels;
+    const size_t stride = WORDS_LEN(rows, k);
+    const size_t block  = CONV2D_IM2COL_WORDS / stride;
+    const size_t ow     = conv2d_output_width(conv);
+    const size_t pixels = conv2d_output_height(conv) * ow;
+    if (block == 0) {
+        conv2d_im2col_unblocked(conv, x, packed, y);
+        return;
+    }
+    for (size_t p0 = 0; p0 < pixels; p0 += block) {
+        size_t len = pixels - p0 < block ? pixels - p0 : block;
+        foreach_to(p, len) {
+            conv2d_im2col_row(conv, x, (p0 + p) / ow, (p0 + p) % ow,
+                              rows + p * stride);
+        }
+        geisten_dispatch()->gemm_xnor(k, len, conv->filters, rows, packed,
+                                      y + p0 * conv->filters, conv->filters,
+                                      1);
+    }
+    if (!conv->padding) return;
+    const size_t s = conv2d_stride(conv), d = conv2d_dilation(conv);
+    foreach_to(oy, conv2d_output_height(conv)) {
+        size_t ky0, ky1;
+        conv2d_clip(oy * s, conv->padding, conv->kernel_h, d, conv->height,
+                    &ky0, &ky1);
+        foreach_to(ox, ow) {
+            size_t kx0, kx1;
+            conv2d_clip(ox * s, conv->padding, conv->kernel_w, d, conv->width,
+                        &kx0, &kx1);
+            if (ky1 - ky0 < conv->kernel_h || kx1 - kx0 < conv->kernel_w) {
+                conv2d_im2col_correct(conv, packed, oy, ox,
+                                      y + (oy * ow + ox) * conv->filters);
+            }
+        }
+    }
+}
+
+/**
+ * ### conv2d_prefer_im2col() - Returns true if `conv2d_im2col()` is faster
+ *
+ * The direct convolution processes `WORDS_LEN(x, channels)` words per filter
+ * pixel. The im2col path wins when its rows save at least a quarter of the
+ * words, i.e. when many channel words are mostly padding, and a receptive
+ * field fits into `CONV2D_IM2COL_WORDS` words. Grouped layers always use
+ * `conv2d()`.
+ */
+static inline int conv2d_prefer_im2col(const struct conv2d* conv) {
+    if (conv->groups > 1) return 0;
+    const size_t area   = conv->kernel_h * conv->kernel_w;
+    const size_t direct = area * ((conv->channels + 63) / 64);
+    const size_t im2col = (area * conv->channels + 63) / 64;
+    if (im2col > CONV2D_IM2COL_WORDS) return 0;
+    return 4 * im2col <= 3 * direct;
+}
+
+/**
+ * ### conv2d_depthwise() - Binary depthwise 2D convolution
+ * - `conv` The shape of the layer with `filters == channels`
+ * - `x` The input image of `height x width` pixels
+ * - `w` The filters as one image of `kernel_h x kernel_w` pixels of
+ *   `channels` bits: bit `c` of the pixels is the filter of channel `c`
+ * - `y` The output image of `channels` values per pixel (NHWC)
+ *
+ * Output channel `c` is the convolution of input channel `c` with its filter,
+ * like `conv2d()` with `groups == channels`, but with the filters packed along
+ * the channels. The differing bits of 64 channels are counted at once per
+ * filter tap with bit-sliced counters: word `j` of the counters holds bit `j`
+ * of the counts of all 64 channels. `groups` is ignored.
+ */
+static inline void conv2d_depthwise(const struct conv2d* conv,
+                                    const unsigned long long x[],
+                                    const unsigned long long w[], int y[]) {
+    const size_t pixel = WORDS_LEN(x, conv->channels);
+    const size_t kh = conv->kernel_h, kw = conv->kernel_w;
+    const size_t ow = conv2d_output_width(conv), pad = conv->padding;
+    const size_t s = conv2d_stride(conv), d = conv2d_dilation(conv);
+    foreach_to(oy, conv2d_output_height(conv)) {
+        size_t ky0, ky1;
+        conv2d_clip(oy * s, pad, kh, d, conv->height, &ky0, &ky1);
+        foreach_to(ox, ow) {
+            size_t kx0, kx1;
+            conv2d_clip(ox * s, pad, kw, d, conv->width, &kx0, &kx1);
+            const int n = (int)((ky1 - ky0) * (kx1 - kx0));
+            int* out    = y + (oy * ow + ox) * conv->channels;
+            foreach_to(i, pixel) {
+                unsigned long long counts[NBITS(size_t)] = {0};
+                size_t slices                            = 0;
+                for (size_t ky = ky0; ky < ky1; ky++) {
+                    for (size_t kx = kx0; kx < kx1; kx++) {
+                        size_t a = (oy * s + ky * d - pad) * conv->width +
+                                   ox * s + kx * d;
+                        unsigned long long carry =
+                            x[(a - pad) * pixel + i] ^
+                            w[(ky * kw + kx) * pixel + i];
+                        /* adds 1 to the counters of the differing channels */
+                        for (size_t j = 0; carry; j++) {
+                            unsigned long long t = counts[j] & carry;
+                            counts[j] ^= carry;
+                            carry = t;
+                            slices = j + 1 > slices ? j + 1 : slices;
+                        }
+                    }
+                }
+                size_t len = conv->channels - i * NBITS(x[0]);
+                foreach_to(c, len < NBITS(x[0]) ? len : NBITS(x[0])) {
+                    int count = 0;
+                    foreach_to(j, slices) {
+                        count |= (int)((counts[j] >> c) & 1) << j;
+                    }
+                    out[i * NBITS(x[0]) + c] = n - 2 * count;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * ### maxpool2d() - Max pooling of a channel packed binary image
+ * - `height` The number of rows of the input image
+ * - `width` The number of columns of the input image
+ * - `channels` The number of channels of each pixel
+ * - `size` The height and width of the pooling window, e.g. 2 or 3
+ * - `stride` The distance of the windows
+ * - `x` The input image in the layout of `conv2d()`
+ * - `y` The output image of `pool2d_output_size(height, size, stride) x
+ *   pool2d_output_size(width, size, stride)` pixels
+ *
+ * The maximum of the +-1 activations of a window is the OR of their bits, so
+ * 64 channels are pooled with one instruction per pixel of the window.
+ */
+static inline void maxpool2d(size_t height, size_t width, size_t channels,
+                             size_t size, size_t stride,
+                             const unsigned long long x[],
+                             unsigned long long y[]) {
+    geisten_dispatch()->pool2d(height, width, channels, size, stride, 0, x, y);
+}
+
+/**
+ * ### minpool2d() - Min pooling of a channel packed binary image
+ *
+ * The AND of the bits of a window, see `maxpool2d()`.
+ */
+static inline void minpool2d(size_t height, size_t width, size_t channels,
+                             size_t size, size_t stride,
+                             const unsigned long long x[],
+                             unsigned long long y[]) {
+    geisten_dispatch()->pool2d(height, width, channels, size, stride, ~0ULL, x,
+                               y);
+}
+
+/**
+ * ### binarize_n() - Binarize the `_n` elements of array `_x`.
+ * - `_n` The length of the array `_x`
+ * - `_x` The input array of `float`, `int16_t`, `uint16_t`, `int8_t` or
+ *   `uint8_t` elements
+ * - `_t` The conversion threshold: an array of `_n` thresholds of the type of
+ *   `_x`, or a single value for all elements
+ * - `_result` The bit array of `WORDS_LEN(_result, _n)` words
+ *
+ * Binarizes all elements of array `_x` and writes the result to the bit array
+ * `_result`. The conversion is as follows:
+ *
+ * ```
+ * if _x[i] >= _t[i] then set bit=1 else set bit=0
+ * ```
+ *
+ * The binarizer is selected by the element type of `_x` and the type of `_t`
+ * (e.g. `binarize_f32()` or `binarize_f32_scalar()`). Unlike
+ * `binarize_at_pos()` every word of `_result` is written as a whole: the
+ * padding bits of the last word are cleared.
+ */
+#define BINARIZE_SELECT(_suffix, _type, _t)     \
+    _Generic((_t), _type*                       \
+             : binarize_##_suffix, const _type* \
+             : binarize_##_suffix, default      \
+             : binarize_##_suffix##_scalar)
+
+#define binarize_n(_n, _x, _t, _result)                    \
+    _Generic((_x)[0], float                                \
+             : BINARIZE_SELECT(f32, float, _t), int16_t    \
+             : BINARIZE_SELECT(i16, int16_t, _t), uint16_t \
+             : BINARIZE_SELECT(u16, uint16_t, _t), int8_t  \
+             : BINARIZE_SELECT(i8, int8_t, _t), uint8_t    \
+             : BINARIZE_SELECT(u8, uint8_t, _t))((_n), (_x), (_t), (_result))
+
+#define BINARIZE_PUBLIC(_suffix, _type)                                  \
+    static inline void binarize_##_suffix(size_t n, const _type x[],     \
+                                          const _type threshold[],       \
+                                          unsigned long long result[]) { \
+        geisten_dispatch()->binarize_##_suffix(n, x, threshold, result); \
+    }                                                                    \
+    static inline void binarize_##_suffix##_scalar(                      \
+        size_t n, const _type x[], _type threshold,                      \
+        unsigned long long result[]) {                                   \
+        geisten_dispatch()->binarize_##_suffix##_scalar(n, x, threshold, \
+                                                        result);         \
+    }
+
+BINARIZE_PUBLIC(f32, float)
+BINARIZE_PUBLIC(i16, int16_t)
+BINARIZE_PUBLIC(u16, uint16_t)
+BINARIZE_PUBLIC(i8, int8_t)
+BINARIZE_PUBLIC(u8, uint8_t)
+
+#undef BINARIZE_PUBLIC
+
+/**
+ * ### residual_binarize() - Residual shortcut and binarization of a block
+ * - `pixels` The number of pixels, `1` for a dense block
+ * - `channels` The number of outputs per pixel
+ * - `y` The `pixels x channels` outputs of the binary block, e.g. of
+ *   `conv2d_scaled()` in the fixed point format of the shortcut
+ * - `shortcut` The `pixels x channels` shortcut values of the block input
+ * - `threshold` The `channels` thresholds of the next binarization
+ * - `result` The bit array of `WORDS_LEN(result, channels)` words per pixel
+ *
+ * Adds the block outputs to the real valued shortcut around a binary block
+ * (Bi-Real, ReActNet) and binarizes the sums:
+ *
+ * ```
+ * shortcut[i] = saturate_int16(shortcut[i] + y[i])
+ * if shortcut[i] >= threshold[i % channels] then set bit=1 else set bit=0
+ * ```
+ *
+ * The sums stay in `shortcut` as the input of the next shortcut. The add,
+ * the store and the comparison are fused, 16 outputs per instruction with
+ * AVX2. The result is a channel packed image for `conv2d()`, the padding
+ * bits of every pixel are cleared.
+ */
+static inline void residual_binarize(size_t pixels, size_t channels,
+                                     const int y[], int16_t shortcut[],
+                                     const int16_t threshold[],
+                                     unsigned long long result[]) {
+    geisten_dispatch()->residual(pixels, channels, y, shortcut, threshold,
+                                 result);
+}
+
+/**
+ * ### global_avgpool_i8() - Global average pooling into int8 values
+ * - `pixels` The number of pixels of the image `x`
+ * - `channels` The number of channels per pixel
+ * - `x` The `pixels x channels` outputs of the last binary layer (NHWC)
+ * - `scale` The factor of the channel sums with `shift` fractional bits,
+ *   including the `1 / pixels` of the mean
+ * - `shift` The number of fractional bits of `scale` (0 to 31)
+ * - `y` The `channels` results
+ *
+ * Computes `y[c] = round(sum(x[p][c]) * scale / 2^shift)` over all pixels `p`,
+ * saturated to [-127, 127], e.g. with the factor of
+ * `scale_quantize(1, &(float){s / pixels}, shift, &scale)` for the int8
+ * quantization scale `1 / s` of the inputs of `dense_i8()`. The image is read
+ * once, the sums of 64 channels at a time stay in the L1 cache.
+ */
+static inline void global_avgpool_i8(size_t pixels, size_t channels,
+                                     const int x[], int32_t scale, int shift,
+                                     int8_t y[]) {
+    const long long round = shift ? 1LL << (shift - 1) : 0;
+    for (size_t c0 = 0; c0 < channels; c0 += 64) {
+        size_t len        = channels - c0 < 64 ? channels - c0 : 64;
+        long long sum[64] = {0};
+        foreach_to(p, pixels) {
+            foreach_to(c, len) { sum[c] += x[p * channels + c0 + c]; }
+        }
+        foreach_to(c, len) {
+            long long v = (sum[c] * scale + round) >> shift;
+            y[c0 + c]   = (int8_t)(v < -127 ? -127 : v > 127 ? 127 : v);
+        }
+    }
+}
+
+/**
+ * ### dense_i8() - Dense layer of int8 weights and inputs, e.g. the classifier
+ * - `n` The number of inputs
+ * - `m` The number of outputs
+ * - `w` The `m` weights rows of `n` values each
+ * - `x` The `n` inputs, e.g. from `global_avgpool_i8()`
+ * - `bias` The `m` biases or `NULL`
+ * - `y` The `m` outputs
+ *
+ * Computes `y[j] = bias[j] + sum(w[j][i] * x[i])` in 32 bits. The weights and
+ * inputs must be in [-127, 127] (symmetric quantization): the AVX2 variant
+ * multiplies 32 pairs per instruction with `pmaddubsw`, which would
+ * overflow for `-128`.
+ */
+static inline void dense_i8(size_t n, size_t m, const int8_t w[],
+                            const int8_t x[], const int32_t bias[],
+                            int32_t y[]) {
+    geisten_dispatch()->dense_i8(n, m, w, x, bias, y);
+}
+
+/**
+ * ### struct conv1d_stream - The state of a streaming binary 1D convolution
+ *
+ * A 1D convolution over a stream of frames, e.g. the binarized features of
+ * audio frames: every pushed frame of `channels` bits yields one output
+ * column of `filters` values, the convolution of the last `kernel` frames.
+ * The frames are kept in a ring buffer, so the outputs of the older columns
+ * are never computed again.
+ *
+ * ```
+ * struct conv1d_stream s = conv1d_stream_alloc(40, 64, 8);
+ * while (read_frame(frame)) {
+ *     conv1d_stream_push(&s, frame, w, y);
+ * }
+ * conv1d_stream_free(&s);
+ * ```
+ *
+ * The ring holds every frame twice, `kernel` frames apart, so the last
+ * `kernel` frames are always consecutive rows and meet a filter in one row of
+ * words, like the filter rows of `conv2d()`.
+ */
+struct conv1d_stream {
+    struct bit_matrix ring; /* 2 * kernel frames of channels bits */
+    size_t filters;         /* output channels */
+    size_t kernel;          /* frames of a filter */
+    size_t frames;          /* frames pushed since the last reset */
+};
+
+/**
+ * ### conv1d_stream_alloc() - Allocate the state of a streaming 1D convolution
+ * - `channels` The number of bits of a frame
+ * - `filters` The number of output channels
+ * - `kernel` The number of frames of a filter, at least 1
+ *
+ * Return a stream with `ring.words == NULL` if the memory cannot be
+ * allocated.
+ */
+static inline struct conv1d_stream conv1d_stream_alloc(size_t channels,
+                                                       size_t filters,
+                                                       size_t kernel) {
+    assert(kernel > 0 && "a filter spans at least one frame");
+    return (struct conv1d_stream){
+        .ring    = bit_matrix_alloc(2 * kernel, channels),
+        .filters = filters,
+        .kernel  = kernel,
+    };
+}
+
+/**
+ * ### conv1d_stream_free() - Release the ring buffer of `conv1d_stream_alloc()`
+ */
+static inline void conv1d_stream_free(struct conv1d_stream* s) {
+    bit_matrix_free(&s->ring);
+}
+
+/**
+ * ### conv1d_stream_reset() - Start a new stream, e.g. after a silence
+ */
+static inline void conv1d_stream_reset(struct conv1d_stream* s) {
+    s->frames = 0;
+}
+
+/**
+ * ### conv1d_stream_push() - Append a frame and compute the newest output column
+ * - `s` The stream from `conv1d_stream_alloc()`
+ * - `frame` The new frame of `WORDS_LEN(frame, channels)` words
+ * - `w` The `filters` filters of `kernel` frames each, the oldest first
+ * - `y` The `filters` outputs of the column that ends with `frame`
+ *
+ * Computes for every filter the sum of `linear_n()` of its frames and the
+ * last `kernel` frames of the stream. Until `kernel` frames are pushed, the
+ * taps before the first frame contribute zero (causal zero padding). A push
+ * costs one output column, while recomputing a window of `window` frames
+ * costs `window - kernel + 1` columns.
+ */
+static inline void conv1d_stream_push(struct conv1d_stream* s,
+                                      const unsigned long long frame[],
+                                      const unsigned long long w[], int y[]) {
+    const size_t slot = s->frames % s->kernel;
+    const size_t size = s->ring.stride * sizeof(frame[0]);
+    memcpy(bit_matrix_row(s->ring, slot), frame, size);
+    memcpy(bit_matrix_row(s->ring, slot + s->kernel), frame, size);
+    s->frames++;
+    /* the newest frame is the second copy, the older ones precede it */
+    size_t taps = s->frames < s->kernel ? s->frames : s->kernel;
+    geisten_dispatch()->conv1d(
+        s->ring.bits, s->filters, s->kernel, taps,
+        bit_matrix_row(s->ring, slot + s->kernel + 1 - taps), w, y);
+}
@@ -3,6 +3,8 @@
 //
 #include <time.h>
 
+/* small im2col blocks to test the block boundaries */
+#define CONV2D_IM2COL_WORDS 64
 #include "geisten.h"
 #include "test.h"
 
@@ -12,34 +14,12 @@ TEST_INIT();
 #define BIT_ARRAY_LEN(_n, _bits) (((_n)-1 + (_bits)) / (_bits))
 #define BIT_ARRAY_SIZE(_arr, _bits) (BIT_ARRAY_LEN(ARRAY_LENGTH(_arr), (_bits)))
 
-/**
- * ## binarize() - Binarize 8 bit fix point elements of array `x`
- * - `size` The length of the arrwy `x`
- * - `x` The fix point array
- * - `threshold` The conversion threshold
- * - `result` The bit result
- *
- * Binarize all elements of array `x` and writes the result to the bit array
- * `result`. The conversion is as follows:
- *
- * ```
- * if x[i] > threshold then set bit=1 else set bit=0
- * ```
- */
-static void binarize_i8(
-    uint32_t size, const int8_t x[size], const uint8_t threshold[size],
-    unsigned long long result[(size / NBITS(unsigned long long)) + 1]) {
-    foreach_to(i, size) { binarize_at_pos(result, i, x, threshold[i]); }
-}
-
 #define BINARIZE(_input, _a, _words) \
     foreach (i, _input) { binarize_at_pos((_words), i, (_input), (_a)[i]); }
 
-#define FORWARD(_words, _w, _output)                        \
-    foreach_to(j, ARRAY_LENGTH(_output)) {                  \
-        foreach (i, (_words)) {                             \
-            (_output)[j] = linear((_w)[j][i], (_words)[i]); \
-        }                                                   \
+#define FORWARD(_words, _n, _w, _output)                  \
+    foreach_to(j, ARRAY_LENGTH(_output)) {                \
+        (_output)[j] = linear_n((_n), (_w)[j], (_words)); \
     }
 
 #define ACTIVATE(_array, _func, _output) \
@@ -76,14 +56,874 @@ static void test_binarization_det() {
                         0,  0,   0,    0, 0,  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                         0,  0,   0,    0, 0,  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                         0,  0,   0,    0, 0,  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    unsigned long long weights_b[1];
-    binarize_i8(ARRAY_LENGTH(weights), weights, 1, weights_b);
+    int8_t threshold[ARRAY_LENGTH(weights)];
+    foreach (i, threshold) { threshold[i] = 1; }
+    unsigned long long weights_b[1] = {0};
+    binarize_i8(ARRAY_LENGTH(weights), weights, threshold, weights_b);
     test(weights_b[0] == 34 &&
          "Positions in bit array must binarized as expected");
     test(BIT_ARRAY_SIZE(weights_demo, sizeof(weights_b[0]) * CHAR_BIT) == 2 &&
          "Array size must be 2");
 }
 
+static unsigned long long random_word() {
+    return ((unsigned long long)random() << 62) ^
+           ((unsigned long long)random() << 31) ^ (unsigned long long)random();
+}
+
+static void test_bit_matrix() {
+    unsigned long long words[3 * 2];
+    struct bit_matrix w = bit_matrix_wrap(3, 100, words);
+    test(w.words == words && w.stride == 2 && w.tail == (1ULL << 36) - 1 &&
+         "wrapped rows are not copied");
+    test(bit_vector_wrap(64, words).tail == ~0ULL && "full last word");
+
+    memset(words, 0xFF, sizeof(words));
+    bit_matrix_clear_padding(w);
+    test(popcount_xor(w.rows * w.stride, words, (unsigned long long[6]){0}) ==
+             3 * 100 &&
+         "only the valid bits remain set");
+    bit_matrix_set(w, 2, 99, 0);
+    test(!bit_matrix_get(w, 2, 99) && bit_matrix_get(w, 2, 98) &&
+         bit_matrix_row(w, 2) == words + 4 && "rows are addressed by stride");
+
+    struct bit_matrix m = bit_matrix_alloc(5, 1000);
+    bool cleared        = m.words != NULL;
+    foreach_to(i, m.rows * m.stride) { cleared &= m.words && m.words[i] == 0; }
+    test(cleared && bit_matrix_is_aligned(m, 1) &&
+         (uintptr_t)m.words % BIT_MATRIX_ALIGNMENT == 0 &&
+         "allocated matrices are cleared and aligned");
+    bit_matrix_free(&m);
+    test(m.words == NULL && "freed matrices have no words");
+}
+
+static void test_popcount() {
+    test(popcount(0ULL) == 0 && "empty word has no bits set");
+    test(popcount(~0ULL) == 64 && "full 64 bit word");
+    test(popcount(~0U) == 32 && "full 32 bit word");
+    test(popcount(1UL << 63) == 1 && "highest bit of long word");
+
+    bool equal = true;
+    foreach_to(i, 1000) {
+        unsigned long long x = random_word();
+        equal &= popcount(x) == popcountll_soft(x);
+        equal &= popcount((unsigned)x) == popcounti_soft((unsigned)x);
+    }
+    test(equal && "native popcount must match the software implementation");
+
+    unsigned long long words[1000] = {0, ~0ULL, 1, 1ULL << 63};
+    for (size_t i = 4; i < ARRAY_LENGTH(words); i++) words[i] = random_word();
+    equal = true;
+    foreach (i, words) {
+        unsigned long long x = words[i];
+        int expected         = popcountll_kernighan(x);
+        equal &= popcountll_swar(x) == expected;
+        equal &= popcountll_table8(x) == expected;
+        equal &= popcountll_table16(x) == expected;
+        equal &= popcounti_swar((unsigned)x) == popcounti_kernighan((unsigned)x);
+        equal &= popcounti_table8((unsigned)x) == popcounti_kernighan((unsigned)x);
+        equal &= popcounti_table16((unsigned)x) == popcounti_kernighan((unsigned)x);
+        equal &= popcountl_soft((unsigned long)x) == popcount((unsigned long)x);
+    }
+    test(equal && "all software popcount variants must count the same bits");
+}
+
+/* The reference: sum of the element wise multiplication of the ±1 values */
+static int linear_naive(size_t n, const unsigned long long w[],
+                        const unsigned long long x[]) {
+    int sum = 0;
+    foreach_to(i, n) {
+        bool wi = (w[WORDS_INDEX(w, i)] >> WORDS_POS(w, i)) & 1;
+        bool xi = (x[WORDS_INDEX(x, i)] >> WORDS_POS(x, i)) & 1;
+        sum += wi == xi ? 1 : -1;
+    }
+    return sum;
+}
+
+static void test_linear() {
+    test(linear(0ULL, 0ULL) == 64 && "equal words sum up to the word size");
+    test(linear(0ULL, ~0ULL) == -64 && "inverted words sum up to -word size");
+
+    unsigned long long w[9], x[9];
+    foreach (i, w) {
+        w[i] = random_word();
+        x[i] = random_word();
+    }
+    bool equal = true;
+    foreach_to(n, NBITS(w)) {
+        equal &= linear_n(n, w, x) == linear_naive(n, w, x);
+    }
+    test(equal && "linear_n must match the naive sum for all row lengths");
+
+    /* padding bits beyond n must not contribute */
+    unsigned long long a[] = {0x1FULL}, b[] = {0xFFFFFFFFFFFFFFFFULL};
+    test(linear_n(5, a, b) == 5 && "padding bits must be ignored");
+    test(linear_n(128, (unsigned long long[]){1, 2},
+                  (unsigned long long[]){1, 2}) == 128 &&
+         "rows without tail word");
+}
+
+static void test_popcount_xor() {
+    static unsigned long long a[300], b[300];
+    foreach (i, a) {
+        a[i] = random_word();
+        b[i] = random_word();
+    }
+    bool equal = true;
+    foreach_to(n, ARRAY_LENGTH(a)) {
+        size_t expected = 0;
+        foreach_to(i, n) { expected += popcountll_soft(a[i] ^ b[i]); }
+        equal &= popcount_xor(n, a, b) == expected;
+        equal &= popcount_xor_generic(n, a, b) == expected;
+#ifdef GEISTEN_X86_64
+        if (geisten_cpu_has(GEISTEN_CPU_AVX2)) {
+            equal &= popcount_xor_avx2(n, a, b) == expected;
+        }
+#endif
+    }
+    test(equal && "all popcount_xor variants must count the differing bits");
+}
+
+static void test_dispatch() {
+    test(geisten_dispatch() != NULL && "kernels are selected on first use");
+    test(geisten_select("no such isa") == NULL && "unknown variant is refused");
+    test(geisten_select("generic") != NULL &&
+         strcmp(geisten_dispatch()->name, "generic") == 0 &&
+         "the generic variant is always supported");
+
+    enum { N = 1000, M = 7 };
+    static unsigned long long w[M][BIT_ARRAY_LEN(N, 64)],
+        x[BIT_ARRAY_LEN(N, 64)];
+    foreach (j, w) {
+        foreach (i, w[j]) { w[j][i] = random_word(); }
+    }
+    foreach (i, x) { x[i] = random_word(); }
+
+    bool equal = true;
+    foreach_kernels(name) {
+        int y[M];
+        dense(N, M, w[0], x, y);
+        foreach (j, y) { equal &= y[j] == linear_naive(N, w[j], x); }
+    }
+    test(equal && "all supported dense variants must match the naive sum");
+
+    const struct geisten_kernels* active = geisten_dispatch();
+    foreach_kernels(name) {
+        if (strcmp(name, "generic") == 0) break;
+    }
+    test(geisten_dispatch() == active &&
+         "leaving foreach_kernels() restores the default variant");
+}
+
+static void test_vector_words() {
+    test(NBITS(word128) == 128 && NBITS(word256) == 256 &&
+         "vector words have the full register width");
+
+    int8_t input[300];
+    foreach (i, input) { input[i] = (int8_t)random(); }
+    unsigned long long bits[BIT_ARRAY_LEN(ARRAY_LENGTH(input), 64)] = {0};
+    word128 bits128[BIT_ARRAY_LEN(ARRAY_LENGTH(input), 128)]        = {0};
+    word256 bits256[BIT_ARRAY_LEN(ARRAY_LENGTH(input), 256)]        = {0};
+    foreach (i, input) {
+        binarize_at_pos(bits, i, input, 0);
+        binarize_at_pos(bits128, i, input, 0);
+        binarize_at_pos(bits256, i, input, 0);
+    }
+    test(memcmp(bits, bits128, sizeof(bits)) == 0 &&
+         memcmp(bits, bits256, sizeof(bits)) == 0 &&
+         "vector words must have the layout of the 64 bit word array");
+
+    word256 w = {random_word(), random_word(), random_word(), random_word()};
+    test(linear(w, bits256[0]) == linear_n(256, (unsigned long long*)&w, bits) &&
+         "linear of vector words sums over all lanes");
+    test(popcount(bits128[0]) ==
+             popcount(bits[0]) + popcount(bits[1]) &&
+         "popcount of vector words");
+    bits128[0] = binarize(bits128[0], 100, 0, -1);
+    test((bits128[0][1] & (1ULL << 36)) == 0 && "binarize clears a high bit");
+    bits128[0] = binarize(bits128[0], 100, 0, 1);
+    test((bits128[0][1] & (1ULL << 36)) != 0 && "binarize sets a high bit");
+}
+
+static void test_gemm_xnor() {
+    /* 131 words: more than one K block, m and n are no multiple of the tile */
+    enum { K = 130 * 64 + 5, M = 9, N = 6, WORDS = BIT_ARRAY_LEN(K, 64) };
+    static unsigned long long a[M * WORDS], b[N * WORDS];
+    foreach (i, a) { a[i] = random_word(); }
+    foreach (j, b) { b[j] = random_word(); }
+
+    bool equal = true;
+    foreach_kernels(name) {
+        /* K, a single word, exactly one K block and rows for the tiles */
+        size_t bits[] = {K, 37, GEMM_XNOR_KC * 64, 20 * 64 + 3};
+        foreach (k, bits) {
+            size_t stride = WORDS_LEN(a, bits[k]);
+            int c[M][N];
+            gemm_xnor(bits[k], M, N, a, b, c[0]);
+            foreach (i, c) {
+                foreach (j, c[i]) {
+                    equal &= c[i][j] == linear_naive(bits[k], a + i * stride,
+                                                     b + j * stride);
+                }
+            }
+        }
+    }
+    test(equal && "gemm_xnor must match the naive sum of all row pairs");
+}
+
+static void test_dense_batch() {
+    enum { N = 700, M = 13, BATCH = 5, WORDS = BIT_ARRAY_LEN(N, 64) };
+    static unsigned long long w[M * WORDS], x[BATCH * WORDS];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = random_word(); }
+
+    bool equal = true;
+    foreach_kernels(name) {
+        /* a single sample and batches without and with full tiles */
+        size_t batches[] = {1, 3, BATCH};
+        foreach (b, batches) {
+            int y[BATCH][M], expected[M];
+            dense_batch(N, M, batches[b], w, x, y[0]);
+            foreach_to(s, batches[b]) {
+                dense(N, M, w, x + s * WORDS, expected);
+                equal &= memcmp(y[s], expected, sizeof(expected)) == 0;
+            }
+        }
+    }
+    test(equal && "dense_batch must compute dense for every sample");
+}
+
+static void test_batchnorm_fold() {
+    enum { N = 700, M = 64, WORDS = BIT_ARRAY_LEN(N, 64) };
+    static unsigned long long w[M * WORDS], x[WORDS];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = random_word(); }
+    float gamma[M], beta[M], mean[M], var[M], bias[M];
+    foreach (j, gamma) {
+        gamma[j] = (random() % 2001 - 1000) / 500.0f;
+        beta[j]  = (random() % 2001 - 1000) / 100.0f;
+        mean[j]  = (random() % 2001 - 1000) / 20.0f;
+        var[j]   = (random() % 1000 + 1) / 10.0f;
+        bias[j]  = (random() % 201 - 100) / 10.0f;
+    }
+    gamma[0] = 0;    /* constant activations */
+    gamma[1] = 0;
+    beta[1]  = -1;
+    mean[2]  = 1e6f; /* thresholds outside of the popcount range */
+    mean[3]  = -1e6f;
+    int threshold[M], y[M];
+    int8_t sign[M];
+    batchnorm_fold(N, M, gamma, beta, mean, var, bias, 1e-5f, threshold, sign);
+    dense(N, M, w, x, y);
+
+    bool equal = true;
+    foreach (j, y) {
+        double z = gamma[j] * (y[j] + bias[j] - mean[j]) /
+                       sqrt((double)var[j] + 1e-5f) +
+                   beta[j];
+        int p = (N - y[j]) / 2;
+        equal &= batchnorm_bit(p, threshold[j], sign[j]) == (z >= 0);
+    }
+    test(equal && "the folded thresholds must match the batch normalization");
+}
+
+static void test_dense_binarize() {
+    enum { N = 700, M = 150, WORDS = BIT_ARRAY_LEN(N, 64) };
+    static unsigned long long w[M * WORDS], x[WORDS];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = random_word(); }
+    int threshold[M], y[M];
+    int8_t sign[M];
+    foreach (j, threshold) {
+        threshold[j] = N / 2 + (int)(random() % 61) - 30;
+        sign[j]      = (int8_t)(random() % 3 - 1);
+        if (sign[j] < 0) threshold[j] = -threshold[j];
+    }
+    dense(N, M, w, x, y);
+    unsigned long long expected[BIT_ARRAY_LEN(M, 64)] = {0};
+    foreach (j, y) {
+        int p = (N - y[j]) / 2;
+        expected[WORDS_INDEX(expected, j)] |=
+            (unsigned long long)batchnorm_bit(p, threshold[j], sign[j])
+            << WORDS_POS(expected, j);
+    }
+
+    bool equal = true;
+    foreach_kernels(name) {
+        unsigned long long result[ARRAY_LENGTH(expected)];
+        memset(result, 0xFF, sizeof(result));
+        dense_binarize(N, M, w, x, threshold, sign, result);
+        equal &= memcmp(result, expected, sizeof(result)) == 0;
+    }
+    test(equal && "dense_binarize must pack the thresholded dense outputs");
+}
+
+static void test_dense_bitplanes() {
+    enum { N = 300, M = 7, WORDS = BIT_ARRAY_LEN(N, 64) };
+    unsigned long long w[M * WORDS], planes[8 * WORDS];
+    uint8_t u[N];
+    int8_t x[N];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) {
+        u[i] = (uint8_t)random();
+        x[i] = (int8_t)random();
+    }
+    u[0] = 255;
+    x[0] = -128;
+    int expected_u[M] = {0}, expected_i[M] = {0};
+    foreach_to(j, M) {
+        const unsigned long long* row = w + j * WORDS;
+        foreach_to(i, N) {
+            int weight = (row[WORDS_INDEX(row, i)] >> WORDS_POS(row, i)) & 1
+                             ? 1
+                             : -1;
+            expected_u[j] += u[i] * weight;
+            expected_i[j] += x[i] * weight;
+        }
+    }
+
+    bool equal = true;
+    foreach_kernels(name) {
+        int y[M];
+        memset(planes, 0xFF, sizeof(planes));
+        bitplanes_u8(N, u, planes);
+        dense_bitplanes_u8(N, M, w, planes, y);
+        equal &= memcmp(y, expected_u, sizeof(y)) == 0;
+        memset(planes, 0xFF, sizeof(planes));
+        bitplanes_i8(N, x, planes);
+        dense_bitplanes_i8(N, M, w, planes, y);
+        equal &= memcmp(y, expected_i, sizeof(y)) == 0;
+    }
+    test(equal && "the bit-plane dot products must match the 8 bit sums");
+}
+
+static void test_transpose_bits() {
+    enum { M = 150, N = 100 };
+    enum { SW = BIT_ARRAY_LEN(N, 64), DW = BIT_ARRAY_LEN(M, 64) };
+    static unsigned long long src[M * SW], dst[N * DW], back[M * SW];
+    foreach (i, src) { src[i] = random_word(); }
+
+    bool equal = true, padding = true, inverse = true;
+    foreach_kernels(name) {
+        memset(dst, 0xFF, sizeof(dst));
+        transpose_bits(M, N, src, dst);
+        foreach_to(r, M) {
+            foreach_to(c, N) {
+                const unsigned long long *s = src + r * SW, *d = dst + c * DW;
+                equal &= ((s[WORDS_INDEX(s, c)] >> WORDS_POS(s, c)) & 1) ==
+                         ((d[WORDS_INDEX(d, r)] >> WORDS_POS(d, r)) & 1);
+            }
+        }
+        foreach_to(c, N) {
+            padding &= (dst[c * DW + DW - 1] & ~tail_mask(M)) == 0;
+        }
+        transpose_bits(N, M, dst, back);
+        foreach_to(r, M) {
+            inverse &= memcmp(back + r * SW, src + r * SW,
+                              (SW - 1) * sizeof(src[0])) == 0 &&
+                       ((back[r * SW + SW - 1] ^ src[r * SW + SW - 1]) &
+                        tail_mask(N)) == 0;
+        }
+    }
+    test(equal && "transpose_bits must swap rows and columns");
+    test(padding && "the padding bits of the transposed rows are cleared");
+    test(inverse && "transposing twice must return the matrix");
+}
+
+/* Returns bit `i` of the bit array `x` */
+#define BIT(_x, _i) \
+    (((_x)[WORDS_INDEX((_x), (_i))] >> WORDS_POS((_x), (_i))) & 1)
+
+/* The reference: the sum of the products of the channels of a group */
+static void conv2d_naive(const struct conv2d* conv,
+                         const unsigned long long x[],
+                         const unsigned long long w[], int y[]) {
+    size_t groups = conv->groups ? conv->groups : 1;
+    size_t cg = conv->channels / groups, fg = conv->filters / groups;
+    size_t pixel = BIT_ARRAY_LEN(conv->channels, 64);
+    size_t fpixel = BIT_ARRAY_LEN(cg, 64);
+    size_t oh = conv2d_output_height(conv), ow = conv2d_output_width(conv);
+    size_t s = conv->stride ? conv->stride : 1;
+    size_t d = conv->dilation ? conv->dilation : 1;
+    foreach_to(oy, oh) {
+        foreach_to(ox, ow) {
+            foreach_to(o, conv->filters) {
+                int sum = 0;
+                foreach_to(ky, conv->kernel_h) {
+                    foreach_to(kx, conv->kernel_w) {
+                        /* the zero padding */
+                        size_t iy = oy * s + ky * d - conv->padding;
+                        size_t ix = ox * s + kx * d - conv->padding;
+                        if (iy >= conv->height || ix >= conv->width) continue;
+                        const unsigned long long* a =
+                            x + (iy * conv->width + ix) * pixel;
+                        const unsigned long long* b =
+                            w + ((o * conv->kernel_h + ky) * conv->kernel_w +
+                                 kx) *
+                                    fpixel;
+                        foreach_to(c, cg) {
+                            bool equal = BIT(a, o / fg * cg + c) == BIT(b, c);
+                            sum += equal ? 1 : -1;
+                        }
+                    }
+                }
+                y[(oy * ow + ox) * conv->filters + o] = sum;
+            }
+        }
+    }
+}
+
+/* Compares both conv2d() paths with conv2d_naive() for all variants */
+static bool conv2d_equal(const struct conv2d* conv) {
+    size_t pixel = BIT_ARRAY_LEN(conv->channels, 64);
+    size_t x_len = conv->height * conv->width * pixel;
+    size_t groups = conv->groups ? conv->groups : 1;
+    size_t w_len  = conv->filters * conv->kernel_h * conv->kernel_w *
+                   BIT_ARRAY_LEN(conv->channels / groups, 64);
+    size_t y_len = conv2d_output_height(conv) * conv2d_output_width(conv) *
+                   conv->filters;
+    unsigned long long *x = malloc(x_len * sizeof(x[0])),
+                       *w = malloc(w_len * sizeof(w[0]));
+    int *y        = malloc(y_len * sizeof(y[0])),
+        *expected = malloc(y_len * sizeof(y[0]));
+    foreach_to(i, x_len) { x[i] = random_word(); }
+    foreach_to(i, w_len) { w[i] = random_word(); }
+    conv2d_naive(conv, x, w, expected);
+
+    size_t k = conv->kernel_h * conv->kernel_w * conv->channels;
+    unsigned long long* packed =
+        malloc(conv->filters * BIT_ARRAY_LEN(k, 64) * sizeof(packed[0]));
+    if (groups == 1) conv2d_im2col_pack(conv, w, packed);
+
+    bool equal = true;
+    foreach_kernels(name) {
+        memset(y, 0x55, y_len * sizeof(y[0]));
+        conv2d(conv, x, w, y);
+        equal &= memcmp(y, expected, y_len * sizeof(y[0])) == 0;
+        if (groups > 1) continue;
+        memset(y, 0x55, y_len * sizeof(y[0]));
+        conv2d_im2col(conv, x, packed, y);
+        equal &= memcmp(y, expected, y_len * sizeof(y[0])) == 0;
+    }
+    free(packed);
+    free(x);
+    free(w);
+    free(y);
+    free(expected);
+    return equal;
+}
+
+static void test_conv2d() {
+    struct conv2d conv = {.height   = 9,
+                          .width    = 7,
+                          .channels = 128,
+                          .filters  = 5,
+                          .kernel_h = 3,
+                          .kernel_w = 3};
+    test(conv2d_output_height(&conv) == 7 && conv2d_output_width(&conv) == 5 &&
+         "the filters do not leave the input");
+    test(conv2d_equal(&conv) && "packed channels");
+    conv.channels = 100;
+    test(conv2d_equal(&conv) && "the padding bits of the pixels are ignored");
+    conv.kernel_h = 1;
+    conv.kernel_w = 5;
+    test(conv2d_equal(&conv) && "rectangular filters");
+    conv.channels = 3;
+    conv.kernel_h = 5;
+    conv.filters  = 9;
+    conv.height   = 20;
+    conv.width    = 20;
+    test(conv2d_equal(&conv) && "few channels per word");
+    test(conv2d_prefer_im2col(&conv) && "few channels prefer im2col");
+    conv.channels = 128;
+    test(!conv2d_prefer_im2col(&conv) && "whole channel words prefer direct");
+
+    conv = (struct conv2d){.height   = 6,
+                           .width    = 5,
+                           .channels = 64,
+                           .filters  = 4,
+                           .kernel_h = 3,
+                           .kernel_w = 3,
+                           .padding  = 1};
+    test(conv2d_output_height(&conv) == 6 && conv2d_output_width(&conv) == 5 &&
+         "the padding keeps the image size");
+    test(conv2d_equal(&conv) && "padded taps contribute zero");
+    conv.channels = 70;
+    conv.kernel_w = 5;
+    conv.padding  = 2;
+    test(conv2d_equal(&conv) && "padding with channel tails");
+    conv.channels = 640; /* 90 words, more than CONV2D_IM2COL_WORDS */
+    conv.kernel_w = 3;
+    conv.padding  = 1;
+    test(conv2d_equal(&conv) && "receptive fields beyond the im2col rows");
+    conv.channels = 3;
+    conv.kernel_h = 47; /* 104 words of mostly padding channels */
+    conv.kernel_w = 47;
+    test(!conv2d_prefer_im2col(&conv) && "too large for the im2col rows");
+
+    conv = (struct conv2d){.height   = 6,
+                           .width    = 7,
+                           .channels = 256,
+                           .filters  = 6,
+                           .kernel_h = 3,
+                           .kernel_w = 3,
+                           .padding  = 1,
+                           .groups   = 2};
+    test(conv2d_equal(&conv) && "groups of whole words");
+    conv.channels = 64;
+    conv.groups   = 4;
+    conv.filters  = 8;
+    test(conv2d_equal(&conv) && "groups smaller than a word");
+    conv.channels = 72;
+    conv.groups   = 3;
+    conv.filters  = 3;
+    test(conv2d_equal(&conv) && "groups across the words");
+    conv.channels = 70;
+    conv.groups   = 70;
+    conv.filters  = 70;
+    test(conv2d_equal(&conv) && "one channel per group");
+
+    conv = (struct conv2d){.height   = 9,
+                           .width    = 11,
+                           .channels = 128,
+                           .filters  = 5,
+                           .kernel_h = 3,
+                           .kernel_w = 3,
+                           .padding  = 1,
+                           .stride   = 2};
+    test(conv2d_output_height(&conv) == 5 && conv2d_output_width(&conv) == 6 &&
+         "only the outputs of the stride are computed");
+    test(conv2d_equal(&conv) && "stride 2");
+    conv.dilation = 2;
+    conv.padding  = 2;
+    conv.stride   = 1;
+    test(conv2d_output_height(&conv) == 9 && conv2d_output_width(&conv) == 11 &&
+         "the dilated filters cover 5 x 5 pixels");
+    test(conv2d_equal(&conv) && "dilation 2");
+    conv.channels = 100;
+    conv.stride   = 3;
+    conv.dilation = 3;
+    test(conv2d_equal(&conv) && "stride and dilation with channel tails");
+    conv.channels = 3;
+    conv.padding  = 0;
+    test(conv2d_equal(&conv) && "stride and dilation of few channels");
+    conv.channels = 128;
+    conv.filters  = 4;
+    conv.groups   = 2;
+    conv.stride   = 2;
+    test(conv2d_equal(&conv) && "grouped stride and dilation");
+}
+
+static void test_conv2d_depthwise() {
+    struct conv2d conv = {.height   = 7,
+                          .width    = 6,
+                          .channels = 100,
+                          .filters  = 100,
+                          .kernel_h = 3,
+                          .kernel_w = 3,
+                          .padding  = 1,
+                          .groups   = 100};
+    enum { PIXEL = BIT_ARRAY_LEN(100, 64) };
+    unsigned long long x[7 * 6 * PIXEL], w[3 * 3 * PIXEL], wg[100 * 3 * 3];
+    int y[7 * 6 * 100], expected[ARRAY_LENGTH(y)];
+    foreach (i, x) { x[i] = random_word(); }
+    foreach (i, w) { w[i] = random_word(); }
+    /* the same filters in the layout of the grouped convolution */
+    foreach_to(c, conv.channels) {
+        foreach_to(k, 3 * 3) { wg[c * 9 + k] = BIT(w + k * PIXEL, c); }
+    }
+    conv2d_naive(&conv, x, wg, expected);
+    conv2d_depthwise(&conv, x, w, y);
+    test(memcmp(y, expected, sizeof(y)) == 0 &&
+         "the depthwise convolution must match the grouped convolution");
+    conv.stride   = 2;
+    conv.dilation = 2;
+    conv.padding  = 2;
+
+    size_t len = conv2d_output_height(&conv) * conv2d_output_width(&conv) *
+                 conv.channels;
+    conv2d_naive(&conv, x, wg, expected);
+    conv2d_depthwise(&conv, x, w, y);
+    test(memcmp(y, expected, len * sizeof(y[0])) == 0 &&
+         "strided and dilated depthwise convolution");
+}
+
+/* The expected outputs `round(y * scale / 2^shift)` */
+static void scale_naive(size_t m, size_t pixels, const int32_t scale[],
+                        int shift, const int y[], int expected[]) {
+    foreach_to(i, pixels * m) {
+        double v    = (double)y[i] * scale[i % m] / ldexp(1, shift);
+        expected[i] = (int)floor(v + 0.5);
+    }
+}
+
+static void test_scaled() {
+    int32_t q[4];
+    scale_quantize(4, (float[]){0.5f, -0.3f, 1e12f, -1e12f}, 8, q);
+    test(q[0] == 128 && q[1] == -77 && q[2] == INT32_MAX &&
+         q[3] == INT32_MIN && "scale factors in Q format, saturated");
+
+    enum { N = 700, M = 150, WORDS = BIT_ARRAY_LEN(N, 64) };
+    static unsigned long long w[M * WORDS], x[WORDS];
+    foreach (i, w) { w[i] = random_word(); }
+    foreach (i, x) { x[i] = random_word(); }
+    int32_t scale[M];
+    int linear_y[M], expected[M], y[M];
+    foreach (j, scale) { scale[j] = (int32_t)(random() % 200001) - 100000; }
+    dense(N, M, w, x, linear_y);
+    bool equal = true;
+    foreach_kernels(name) {
+        for (int shift = 0; shift < 32; shift += 7) {
+            scale_naive(M, 1, scale, shift, linear_y, expected);
+            dense_scaled(N, M, w, x, scale, shift, y);
+            equal &= memcmp(y, expected, sizeof(y)) == 0;
+        }
+    }
+    test(equal && "dense_scaled() rounds the scaled outputs");
+
+    struct conv2d conv = {.height   = 6,
+                          .width    = 5,
+                          .channels = 100,
+                          .filters  = 12,
+                          .kernel_h = 3,
+                          .kernel_w = 3,
+                          .padding  = 1};
+    enum { PIXELS = 6 * 5, PIXEL = BIT_ARRAY_LEN(100, 64) };
+    static unsigned long long image[PIXELS * PIXEL], filters[12 * 9 * PIXEL];
+    static int conv_y[PIXELS * 12], conv_expected[PIXELS * 12];
+    foreach (i, image) { image[i] = random_word(); }
+    foreach (i, filters) { filters[i] = random_word(); }
+    for (size_t groups = 1; groups <= 2; groups++) {
+        conv.groups = groups;
+        conv2d_naive(&conv, image, filters, conv_y);
+        scale_naive(12, PIXELS, scale, 10, conv_y, conv_expected);
+        foreach_kernels(name) {
+            conv2d_scaled(&conv, image, filters, scale, 10, conv_y);
+            equal &= memcmp(conv_y, conv_expected, sizeof(conv_y)) == 0;
+        }
+    }
+    test(equal && "conv2d_scaled() scales the outputs of every filter");
+}
+
+static void test_residual_binarize() {
+    enum { PIXELS = 3, C = 150, PIXEL = BIT_ARRAY_LEN(C, 64) };
+    int y[PIXELS * C];
+    int16_t input[PIXELS * C], shortcut[PIXELS * C], expected[PIXELS * C];
+    int16_t threshold[C];
+    foreach (i, y) { y[i] = (int)(random() % 20001) - 10000; }
+    foreach (i, input) { input[i] = (int16_t)(random() % 60001 - 30000); }
+    foreach (j, threshold) { threshold[j] = (int16_t)(random() % 8001 - 4000); }
+    y[0]        = 100000; /* saturated */
+    y[1]        = -100000;
+    y[2]        = INT_MAX; /* must not wrap in the 32 bit lanes */
+    y[3]        = INT_MIN;
+    input[2]    = 1;
+    input[3]    = -1;
+    unsigned long long bits[PIXELS * PIXEL] = {0};
+    foreach (i, expected) {
+        long long v = (long long)input[i] + y[i];
+        expected[i] = (int16_t)(v > INT16_MAX   ? INT16_MAX
+                                : v < INT16_MIN ? INT16_MIN
+                                                : v);
+        if (expected[i] >= threshold[i % C]) {
+            bits[i / C * PIXEL + i % C / 64] |= 1ULL << (i % C % 64);
+        }
+    }
+    bool equal = true;
+    foreach_kernels(name) {
+        unsigned long long result[PIXELS * PIXEL];
+        memset(result, 0x55, sizeof(result));
+        memcpy(shortcut, input, sizeof(shortcut));
+        residual_binarize(PIXELS, C, y, shortcut, threshold, result);
+        equal &= memcmp(shortcut, expected, sizeof(shortcut)) == 0 &&
+                 memcmp(result, bits, sizeof(bits)) == 0;
+    }
+    test(equal && "the shortcut sums are saturated and binarized per pixel");
+}
+
+static void test_classifier_head() {
+    enum { PIXELS = 49, C = 100, N = 1000, M = 11 };
+    static int x[PIXELS * C];
+    foreach (i, x) { x[i] = (int)(random() % 2001) - 1000; }
+    x[0] = 1000000; /* saturated channel */
+    int32_t scale;
+    scale_quantize(1, &(float){1.0f / PIXELS}, 16, &scale);
+    int8_t pooled[C];
+    global_avgpool_i8(PIXELS, C, x, scale, 16, pooled);
+    bool equal = pooled[0] == 127;
+    for (size_t c = 1; c < C; c++) {
+        long long sum = 0;
+        foreach_to(p, PIXELS) { sum += x[p * C + c]; }
+        double mean = floor(sum * (double)scale / 65536 + 0.5);
+        equal &= pooled[c] == (int8_t)fmax(-127, fmin(mean, 127));
+    }
+    test(equal && "the rounded channel means are saturated to int8");
+
+    static int8_t w[M * N], in[N];
+    foreach (i, w) { w[i] = (int8_t)(random() % 255 - 127); }
+    foreach (i, in) { in[i] = (int8_t)(random() % 255 - 127); }
+    w[0] = in[0] = -127;
+    w[1] = in[1] = 127;
+    int32_t bias[M], expected[M], y[M];
+    foreach (j, bias) {
+        bias[j]     = (int32_t)(random() % 2001) - 1000;
+        expected[j] = bias[j];
+        foreach_to(i, N) { expected[j] += w[j * N + i] * in[i]; }
+    }
+    equal = true;
+    foreach_kernels(name) {
+        dense_i8(N, M, w, in, bias, y);
+        equal &= memcmp(y, expected, sizeof(y)) == 0;
+        dense_i8(N, M, w, in, NULL, y);
+        foreach (j, y) { equal &= y[j] == expected[j] - bias[j]; }
+    }
+    test(equal && "dense_i8() computes the exact int32 sums");
+}
+
+/* Pushes `frames` random frames and compares every column with the sums */
+static bool conv1d_stream_equal(size_t channels, size_t filters, size_t kernel,
+                                size_t frames) {
+    size_t pixel = BIT_ARRAY_LEN(channels, 64);
+    unsigned long long *x = malloc(frames * pixel * sizeof(x[0])),
+                       *w = malloc(filters * kernel * pixel * sizeof(w[0]));
+    int *y = malloc(filters * sizeof(y[0]));
+    foreach_to(i, frames * pixel) { x[i] = random_word(); }
+    foreach_to(i, filters * kernel * pixel) { w[i] = random_word(); }
+    bool equal = true;
+    foreach_kernels(name) {
+        struct conv1d_stream s = conv1d_stream_alloc(channels, filters, kernel);
+        foreach_to(t, frames) {
+            if (t == frames / 2 + 1) conv1d_stream_reset(&s);
+            conv1d_stream_push(&s, x + t * pixel, w, y);
+            size_t start = t > frames / 2 ? frames / 2 + 1 : 0;
+            foreach_to(o, filters) {
+                int sum = 0;
+                foreach_to(k, kernel) {
+                    /* the frame of tap k, before the start it is zero */
+                    size_t f = t + k + 1;
+                    if (f < kernel || f - kernel < start) continue;
+                    sum += linear_naive(channels, w + (o * kernel + k) * pixel,
+                                        x + (f - kernel) * pixel);
+                }
+                equal &= y[o] == sum;
+            }
+        }
+        conv1d_stream_free(&s);
+    }
+    free(x);
+    free(w);
+    free(y);
+    return equal;
+}
+
+static void test_conv1d_stream() {
+    test(conv1d_stream_equal(128, 8, 5, 20) && "packed channels");
+    test(conv1d_stream_equal(40, 7, 3, 10) && "the padding bits are ignored");
+    test(conv1d_stream_equal(512, 3, 9, 30) && "long filter rows");
+    test(conv1d_stream_equal(64, 4, 1, 4) && "one frame per filter");
+}
+
+/* Compares maxpool2d() and minpool2d() with the bits of the windows */
+static bool pool2d_equal(size_t height, size_t width, size_t channels,
+                         size_t size, size_t stride) {
+    size_t pixel = BIT_ARRAY_LEN(channels, 64);
+    size_t oh    = pool2d_output_size(height, size, stride);
+    size_t ow    = pool2d_output_size(width, size, stride);
+    unsigned long long *x = malloc(height * width * pixel * sizeof(x[0])),
+                       *max = malloc(oh * ow * pixel * sizeof(x[0])),
+                       *min = malloc(oh * ow * pixel * sizeof(x[0]));
+    foreach_to(i, height * width * pixel) {
+        /* sparse and dense bits, so that neither OR nor AND saturates */
+        x[i] = random() % 2 ? random_word() | random_word()
+                            : random_word() & random_word();
+    }
+
+    bool equal = true;
+    foreach_kernels(name) {
+        maxpool2d(height, width, channels, size, stride, x, max);
+        minpool2d(height, width, channels, size, stride, x, min);
+        foreach_to(o, oh * ow) {
+            foreach_to(c, channels) {
+                bool any = false, all = true;
+                foreach_to(ky, size) {
+                    foreach_to(kx, size) {
+                        size_t i = ((o / ow * stride + ky) * width +
+                                    o % ow * stride + kx) *
+                                   pixel;
+                        bool bit = (x[i + c / 64] >> (c % 64)) & 1;
+                        any |= bit;
+                        all &= bit;
+                    }
+                }
+                equal &= ((max[o * pixel + c / 64] >> (c % 64)) & 1) == any;
+                equal &= ((min[o * pixel + c / 64] >> (c % 64)) & 1) == all;
+            }
+        }
+    }
+    free(x);
+    free(max);
+    free(min);
+    return equal;
+}
+
+static void test_pool2d() {
+    test(pool2d_output_size(9, 2, 2) == 4 && pool2d_output_size(9, 3, 2) == 4 &&
+         "the windows do not leave the input");
+    test(pool2d_equal(8, 9, 100, 2, 2) && "2x2 windows with stride 2");
+    test(pool2d_equal(9, 7, 320, 3, 2) && "3x3 windows with stride 2");
+    test(pool2d_equal(5, 5, 512, 3, 1) && "overlapping windows");
+}
+
+/* Compares binarize_n() with binarize_at_pos() for all supported variants */
+#define BINARIZE_EQUAL(_type, _random)                                      \
+    ({                                                                      \
+        _type x_[1000], t_[ARRAY_LENGTH(x_)];                               \
+        foreach (i, x_) {                                                   \
+            x_[i] = (_type)(_random);                                       \
+            t_[i] = (_type)(_random);                                       \
+        }                                                                   \
+        x_[0] = t_[0] = (_type)(_random); /* equal values are set */        \
+        const _type s_ = x_[1]; /* a scalar threshold */                    \
+        bool equal_ = true;                                                 \
+        foreach_kernels(name) {                                             \
+            /* whole words and a tail word; the padding must be cleared */  \
+            size_t sizes[] = {ARRAY_LENGTH(x_), 640, 5};                    \
+            foreach (k, sizes) {                                            \
+                unsigned long long e_[BIT_ARRAY_LEN(ARRAY_LENGTH(x_), 64)]; \
+                unsigned long long es_[ARRAY_LENGTH(e_)];                   \
+                unsigned long long r_[ARRAY_LENGTH(e_)];                    \
+                unsigned long long rs_[ARRAY_LENGTH(e_)];                   \
+                memset(e_, 0, sizeof(e_));                                  \
+                memset(es_, 0, sizeof(es_));                                \
+                memset(r_, 0xFF, sizeof(r_));                               \
+                memset(rs_, 0xFF, sizeof(rs_));                             \
+                foreach_to(i, sizes[k]) {                                   \
+                    binarize_at_pos(e_, i, x_, t_[i]);                      \
+                    binarize_at_pos(es_, i, x_, s_);                        \
+                }                                                           \
+                binarize_n(sizes[k], x_, t_, r_);                           \
+                binarize_n(sizes[k], x_, s_, rs_);                          \
+                size_t bytes = WORDS_LEN(r_, sizes[k]) * sizeof(r_[0]);     \
+                equal_ &= memcmp(r_, e_, bytes) == 0;                       \
+                equal_ &= memcmp(rs_, es_, bytes) == 0;                     \
+            }                                                               \
+        }                                                                   \
+        equal_;                                                             \
+    })
+
+static void test_binarize_n() {
+    test(BINARIZE_EQUAL(float, (random() % 2001 - 1000) / 8.0f) &&
+         "binarize_f32 must set the bits of binarize_at_pos");
+    test(BINARIZE_EQUAL(int16_t, random()) &&
+         "binarize_i16 must set the bits of binarize_at_pos");
+    test(BINARIZE_EQUAL(uint16_t, random()) &&
+         "binarize_u16 must set the bits of binarize_at_pos");
+    test(BINARIZE_EQUAL(int8_t, random()) &&
+         "binarize_i8 must set the bits of binarize_at_pos");
+    test(BINARIZE_EQUAL(uint8_t, random()) &&
+         "binarize_u8 must set the bits of binarize_at_pos");
+}
+
 static void test_forward() {
     int8_t input[]               = {5, -2, 0, 3, -1};
     unsigned long long wb[][(ARRAY_LENGTH(input) / NBITS(unsigned long long) +
@@ -95,10 +935,10 @@ static void test_forward() {
         input_bits[(ARRAY_LENGTH(input) / NBITS(unsigned long long) + 1)] = {0};
 
     BINARIZE(input, alpha, input_bits);
-    FORWARD(input_bits, wb, y);
+    FORWARD(input_bits, ARRAY_LENGTH(input), wb, y);
     ACTIVATE(y, relu, y);
 
-    int y_expected[] = {0, 0, 2, 2};
+    int y_expected[] = {0, 0, 0, 1};
     test(input_bits[0] == 9 && "convert input into binary form");
     test(vec_is_equal(OUTPUT_SIZE, y, y_expected, 1) &&
          "transform to output vector");
@@ -108,6 +948,26 @@ int main() {
     srandom(time(NULL));
     test_relu();
     test_binarization_det();
+    test_bit_matrix();
+    test_popcount();
+    test_popcount_xor();
+    test_linear();
+    test_dispatch();
+    test_vector_words();
+    test_gemm_xnor();
+    test_dense_batch();
+    test_batchnorm_fold();
+    test_dense_binarize();
+    test_dense_bitplanes();
+    test_transpose_bits();
+    test_conv2d();
+    test_conv2d_depthwise();
+    test_scaled();
+    test_residual_binarize();
+    test_classifier_head();
+    test_conv1d_stream();
+    test_pool2d();
+    test_binarize_n();
     test_forward();
     return TEST_RESULT;
 }